@@ -19,7 +19,8 @@ CgiStatus ICACHE_FLASH_ATTR authBasic(HttpdConnData *connData) {
 	const char *unauthorized = "401 Unauthorized.";
 	int no=0;
 	int r;
-	char hdr[(AUTH_MAX_USER_LEN+AUTH_MAX_PASS_LEN+2)*10];
+	const char *hdr;
+	int hdrLen;
 	char userpass[AUTH_MAX_USER_LEN+AUTH_MAX_PASS_LEN+2];
 	char user[AUTH_MAX_USER_LEN];
 	char pass[AUTH_MAX_PASS_LEN];
@@ -30,9 +31,9 @@ CgiStatus ICACHE_FLASH_ATTR authBasic(HttpdConnData *connData) {
 		return HTTPD_CGI_DONE;
 	}
 
-	r=httpdGetHeader(connData, "Authorization", hdr, sizeof(hdr));
-	if (r && strncmp(hdr, "Basic", 5)==0) {
-		r=libesphttpd_base64_decode(strlen(hdr)-6, hdr+6, sizeof(userpass), (unsigned char *)userpass);
+	r=httpdGetHeaderView(connData, "Authorization", &hdr, &hdrLen);
+	if (r && hdrLen>6 && strncmp(hdr, "Basic ", 6)==0) {
+		r=libesphttpd_base64_decode(hdrLen-6, hdr+6, sizeof(userpass)-1, (unsigned char *)userpass);
 		if (r<0) r=0; //just clean out string on decode error
 		userpass[r]=0; //zero-terminate user:pass string
 //		printf("Auth: %s\n", userpass);
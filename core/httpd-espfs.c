@@ -106,7 +106,7 @@ serveStaticFile(HttpdConnData *connData, const char* filepath) {
 	espfs_file_t *file=connData->cgiData;
 	int len;
 	char buff[FILE_CHUNK_LEN+1];
-	char acceptEncodingBuffer[64];
+	const char *acceptEncoding;
 	int isGzip;
 
 	if (connData->isConnectionClosed) {
@@ -145,8 +145,8 @@ serveStaticFile(HttpdConnData *connData, const char* filepath) {
 		if (isGzip) {
 			// Check the browser's "Accept-Encoding" header. If the client does not
 			// advertise that he accepts GZIP send a warning message (telnet users for e.g.)
-			bool found = httpdGetHeader(connData, "Accept-Encoding", acceptEncodingBuffer, sizeof(acceptEncodingBuffer));
-			if (!found || (strstr(acceptEncodingBuffer, "gzip") == NULL)) {
+			bool found = httpdGetHeaderView(connData, "Accept-Encoding", &acceptEncoding, NULL);
+			if (!found || (strstr(acceptEncoding, "gzip") == NULL)) {
 				//No Accept-Encoding: gzip header present
 				httpdSend(connData, gzipNonSupportedMessage, -1);
 				espfs_fclose(file);
@@ -196,6 +196,11 @@ serveStaticFile(HttpdConnData *connData, const char* filepath) {
 			httpdHeader(connData, "Cache-Control", "max-age=3600, must-revalidate");
 		}
 		httpdEndHeaders(connData);
+		//A HEAD request only wants the headers, don't read the file.
+		if (connData->requestType==HTTPD_METHOD_HEAD) {
+			espfs_fclose(file);
+			return HTTPD_CGI_DONE;
+		}
 		return HTTPD_CGI_MORE;
 	}
 
@@ -325,15 +330,14 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspFsTemplate(HttpdConnData *connData) {
 		//Connection aborted. Clean up.
 		((TplCallback)(connData->cgiArg2))(connData, NULL, &tpd->tplArg);
 		espfs_fclose(tpd->file);
-		free(tpd);
 		return HTTPD_CGI_DONE;
 	}
 
 	if (tpd==NULL) {
 		//First call to this cgi. Open the file so we can read it.
-		tpd=(TplData *)malloc(sizeof(TplData));
+		tpd=(TplData *)httpdArenaAlloc(connData, sizeof(TplData));
 		if (tpd==NULL) {
-			ESP_LOGE(TAG, "Failed to malloc tpl struct");
+			ESP_LOGE(TAG, "Failed to alloc tpl struct");
 			return HTTPD_CGI_NOTFOUND;
 		}
 
@@ -347,7 +351,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspFsTemplate(HttpdConnData *connData) {
 			// maybe a folder, look for index file
 			tpd->file = tryOpenIndex(filepath);
 			if (tpd->file == NULL) {
-				free(tpd);
 				return HTTPD_CGI_NOTFOUND;
 			}
 		}
@@ -361,7 +364,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspFsTemplate(HttpdConnData *connData) {
 		if (s.flags & ESPFS_FLAG_GZIP) {
 			ESP_LOGE(TAG, "cgiEspFsTemplate: Trying to use gzip-compressed file %s as template", connData->url);
 			espfs_fclose(tpd->file);
-			free(tpd);
 			return HTTPD_CGI_NOTFOUND;
 		}
 		connData->cgiData=tpd;
@@ -536,7 +538,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspFsTemplate(HttpdConnData *connData) {
 		((TplCallback)(connData->cgiArg2))(connData, NULL, &tpd->tplArg);
 		ESP_LOGD(TAG, "Template sent");
 		espfs_fclose(tpd->file);
-		free(tpd);
 		return HTTPD_CGI_DONE;
 	} else {
 		//Ok, till next time.
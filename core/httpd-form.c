@@ -0,0 +1,99 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+Streaming application/x-www-form-urlencoded parser, see httpd-form.h
+
+The value bytes of the piece being fed are decoded towards its start, so a fragment of a
+value is a contiguous run of the piece that is handed to the callback when the field ends
+or the piece does. Decoding never writes ahead of the byte being read.
+*/
+
+#include <string.h>
+#include "libesphttpd/httpd-form.h"
+
+static char hexVal(char c) {
+    if (c>='0' && c<='9') return c-'0';
+    if (c>='A' && c<='F') return c-'A'+10;
+    if (c>='a' && c<='f') return c-'a'+10;
+    return 0;
+}
+
+static bool formEmit(HttpdFormParser *parser, HttpdFormEvent event, const char *value, int len) {
+    parser->name[parser->nameLen]=0;
+    if (!parser->cb(parser, event, parser->name, value, len, parser->arg)) parser->failed=true;
+    return !parser->failed;
+}
+
+//End of a field: a '&' or the end of the form.
+static bool formEndField(HttpdFormParser *parser, const char *value, int len) {
+    bool ret=true;
+    //Empty fields, eg. of '&&', are skipped
+    if (parser->inValue || parser->nameLen>0) ret=formEmit(parser, HTTPD_FORM_END, value, len);
+    parser->inValue=false;
+    parser->nameLen=0;
+    return ret;
+}
+
+void httpdFormInit(HttpdFormParser *parser, HttpdFormCb cb, void *arg) {
+    memset(parser, 0, sizeof(*parser));
+    parser->cb=cb;
+    parser->arg=arg;
+}
+
+bool httpdFormFeed(HttpdFormParser *parser, char *data, int len) {
+    char *frag=data;    // start of the value fragment of this piece
+    char *w=data;       // end of it, decoded bytes are written here
+
+    if (parser->failed) return false;
+    for (int i=0; i<len; i++) {
+        char c=data[i];
+        if (parser->esc) {
+            parser->escVal=(parser->escVal<<4)+hexVal(c);
+            if (parser->esc++==1) continue;
+            //Escape complete, its value is a literal character, even '&' or '='
+            parser->esc=0;
+            c=parser->escVal;
+        } else if (c=='%') {
+            parser->esc=1;
+            parser->escVal=0;
+            continue;
+        } else if (c=='&') {
+            if (!formEndField(parser, frag, w-frag)) return false;
+            frag=w=&data[i+1];
+            continue;
+        } else if (c=='=' && !parser->inValue) {
+            parser->inValue=true;
+            frag=w=&data[i+1];
+            continue;
+        } else if (c=='+') {
+            c=' ';
+        }
+
+        if (parser->inValue) {
+            *w++=c;
+        } else if (parser->nameLen<HTTPD_FORM_MAX_NAME_LEN) {
+            parser->name[parser->nameLen++]=c;
+        }
+    }
+
+    //The rest of the value comes with the next piece
+    if (parser->inValue && w>frag) return formEmit(parser, HTTPD_FORM_VALUE, frag, w-frag);
+    return true;
+}
+
+bool httpdFormFinish(HttpdFormParser *parser) {
+    if (parser->failed) return false;
+    //An incomplete escape at the end is dropped
+    parser->esc=0;
+    return formEndField(parser, "", 0);
+}
+
+bool httpdFormFeedPost(HttpdFormParser *parser, HttpdConnData *conn) {
+    if (conn->post.buff!=NULL && conn->post.buffLen>0) {
+        if (!httpdFormFeed(parser, conn->post.buff, conn->post.buffLen)) return false;
+    }
+    if (conn->post.received>=conn->post.len) return httpdFormFinish(parser);
+    return true;
+}
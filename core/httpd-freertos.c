@@ -15,14 +15,24 @@ Thanks to my collague at Espressif for writing the foundations of this code.
 #if defined(linux) || defined(FREERTOS)
 
 #ifdef linux
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4()
+#endif
 #include <libesphttpd/linux.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #else
 #include <libesphttpd/esp.h>
+#include <errno.h>
 #endif
 
 #include "libesphttpd/httpd.h"
@@ -30,6 +40,32 @@ Thanks to my collague at Espressif for writing the foundations of this code.
 #include "httpd-platform.h"
 #include "libesphttpd/httpd-freertos.h"
 
+#ifdef HTTPD_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+#include <poll.h>
+#endif
+
+// the server loop keeps track of the events each connection waits for
+#if defined(HTTPD_USE_EPOLL) || defined(HTTPD_USE_IO_URING)
+#define HTTPD_USE_CONN_EVENTS 1
+#endif
+
+// session resumption relies on the session cache and ticket key callback of openssl, the
+// esp-idf openssl wrapper doesn't provide them
+#if defined(CONFIG_ESPHTTPD_SSL_SUPPORT) && defined(linux)
+#define HTTPD_SSL_SESSION_RESUMPTION 1
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define HTTPD_SSL_KTLS 1
+#endif
+#endif
+
 #include "esp_log.h"
 
 #ifdef FREERTOS
@@ -37,6 +73,25 @@ Thanks to my collague at Espressif for writing the foundations of this code.
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#ifdef ESP32
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#endif
+#endif
+
+// server tasks sleeping in select() are woken up through an eventfd, esp-idf provides one that
+// works with select() since v4.3. Without it the task looks at its command queue at least every
+// HTTPD_CMD_POLL_MS.
+#if defined(linux)
+#define HTTPD_WAKE_EVENTFD 1
+#elif defined(ESP32)
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+#define HTTPD_WAKE_EVENTFD 1
+#include "esp_vfs_eventfd.h"
+#endif
+#endif
+#ifndef HTTPD_WAKE_EVENTFD
+#define HTTPD_CMD_POLL_MS 10
 #endif
 
 #define fr_of_instance(instance) esp_container_of(instance, HttpdFreertosInstance, httpdInstance)
@@ -45,6 +100,113 @@ Thanks to my collague at Espressif for writing the foundations of this code.
 
 const static char* TAG = "httpd-freertos";
 
+static const char *timeoutNames[HTTPD_TIMEOUT_KIND_COUNT] = {
+    "none", "handshake", "header", "body", "keep-alive", "write"
+};
+
+/**
+ * Monotonic millisecond clock of the timer wheels
+ */
+static uint64_t platTimeMs(void)
+{
+#ifdef linux
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#elif defined(ESP32)
+    return esp_timer_get_time() / 1000;
+#else
+    return (uint64_t)xTaskGetTickCount() * portTICK_PERIOD_MS;
+#endif
+}
+
+#ifdef HTTPD_USE_EPOLL
+/**
+ * Bring the registered epoll events of a connection in line with needWriteDoneNotif.
+ *
+ * epoll_ctl() is thread-safe so this may also be called from outside of the server task,
+ * for example when a websocket message is pushed from an application thread.
+ */
+static void platUpdateConnEvents(RtosConnType *pRconn)
+{
+    if(pRconn->fd == -1 || pRconn->ctx == NULL) return;
+
+    uint32_t events = EPOLLIN | (pRconn->needWriteDoneNotif ? EPOLLOUT : 0);
+    if(events != pRconn->epollEvents)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = pRconn;
+        if(epoll_ctl(pRconn->ctx->epollFd, EPOLL_CTL_MOD, pRconn->fd, &ev) == 0)
+        {
+            pRconn->epollEvents = events;
+        } else
+        {
+            ESP_LOGE(TAG, "epoll_ctl(MOD) fd %d", pRconn->fd);
+        }
+    }
+}
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+static void platPostCommand(ServerTaskContext *ctx, HttpdPlatCmd *cmd);
+static void platUringArmConn(ServerTaskContext *ctx, RtosConnType *pRconn);
+
+/**
+ * Submit the io_uring requests a connection needs for its current state
+ *
+ * The ring may only be used by the server task, when called from another thread (for example
+ * when a websocket message is pushed from an application thread) the server task is asked to
+ * do it through its command queue.
+ */
+static void platUpdateConnEvents(RtosConnType *pRconn)
+{
+    ServerTaskContext *ctx = pRconn->ctx;
+    if(pRconn->fd == -1 || ctx == NULL) return;
+
+    if(pthread_equal(pthread_self(), ctx->loopThread))
+    {
+        platUringArmConn(ctx, pRconn);
+    } else if(!__atomic_exchange_n(&pRconn->eventsQueued, 1, __ATOMIC_SEQ_CST))
+    {
+        platPostCommand(ctx, &pRconn->eventsCmd);
+    }
+}
+
+/**
+ * Copy data to the send buffer of a connection, the server task submits a send request for it
+ *
+ * @return bytes taken, 0 while the buffer is full, -1 if no buffer could be allocated
+ */
+static int platUringQueueSend(RtosConnType *pRconn, const void *buff, int len)
+{
+    if(!pRconn->uringSendBuf)
+    {
+        pRconn->uringSendBuf = malloc(CONFIG_ESPHTTPD_IO_URING_SEND_BUF_SIZE);
+        if(!pRconn->uringSendBuf)
+        {
+            ESP_LOGE(TAG, "malloc uringSendBuf");
+            return -1;
+        }
+    }
+
+    int space = CONFIG_ESPHTTPD_IO_URING_SEND_BUF_SIZE - pRconn->uringSendLen;
+    if(len > space) len = space;
+    memcpy(pRconn->uringSendBuf + pRconn->uringSendLen, buff, len);
+    pRconn->uringSendLen += len;
+    return len;
+}
+#endif
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+/**
+ * Data sent on the connection has to pass through SSL_write()
+ */
+static bool platSslWrites(HttpdFreertosInstance *pFR, RtosConnType *pRconn)
+{
+    return (pFR->httpdFlags & HTTPD_FLAG_SSL) && !pRconn->ktlsSend;
+}
+#endif
 
 int ICACHE_FLASH_ATTR httpdPlatSendData(HttpdInstance *pInstance, HttpdConnData *pConn, char *buff, int len) {
     int bytesWritten;
@@ -55,24 +217,167 @@ int ICACHE_FLASH_ATTR httpdPlatSendData(HttpdInstance *pInstance, HttpdConnData
     pRconn->needWriteDoneNotif=1;
 
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-    if(pFR->httpdFlags & HTTPD_FLAG_SSL)
+    if(platSslWrites(pFR, pRconn))
     {
         bytesWritten = SSL_write(pRconn->ssl, buff, len);
+        if(bytesWritten <= 0)
+        {
+            int ssl_error = SSL_get_error(pRconn->ssl, bytesWritten);
+            if(ssl_error == SSL_ERROR_WANT_WRITE)
+            {
+                bytesWritten = 0;
+            } else if(ssl_error == SSL_ERROR_WANT_READ)
+            {
+                // waiting for the socket to become writable wouldn't help, the next readable
+                // event resumes sending, see platHandleConnReadable()
+                pRconn->needWriteDoneNotif = 0;
+                pRconn->sslWriteWantsRead = true;
+                bytesWritten = 0;
+            } else
+            {
+                ESP_LOGE(TAG, "SSL_write ssl_error %d", ssl_error);
+                bytesWritten = -1;
+            }
+        }
     } else
 #endif
-    bytesWritten = write(pRconn->fd, buff, len);
+    {
+#ifdef HTTPD_USE_IO_URING
+        bytesWritten = platUringQueueSend(pRconn, buff, len);
+#else
+        bytesWritten = write(pRconn->fd, buff, len);
+        if(bytesWritten < 0)
+        {
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+            {
+                // socket buffer is full, the rest is written on the next writable event
+                bytesWritten = 0;
+            } else
+            {
+                ESP_LOGE(TAG, "write fd %d errno %d", pRconn->fd, errno);
+            }
+        }
+#endif
+    }
+
+#ifdef HTTPD_USE_CONN_EVENTS
+    platUpdateConnEvents(pRconn);
+#endif
+
+    return bytesWritten;
+}
+
+int ICACHE_FLASH_ATTR httpdPlatSendDataV(HttpdInstance *pInstance, HttpdConnData *pConn, const struct iovec *iov, int iovcnt) {
+    int bytesWritten = 0;
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    HttpdFreertosInstance *pFR = fr_of_instance(pInstance);
+    if(platSslWrites(pFR, pRconn))
+    {
+        // every buffer has to pass through SSL_write(), stop at the first one that isn't taken completely
+        for(int i = 0; i < iovcnt; i++)
+        {
+            int r = httpdPlatSendData(pInstance, pConn, iov[i].iov_base, iov[i].iov_len);
+            if(r < 0) return r;
+            bytesWritten += r;
+            if(r < iov[i].iov_len) break;
+        }
+        return bytesWritten;
+    }
+#endif
+    pRconn->needWriteDoneNotif=1;
+
+#ifdef HTTPD_USE_IO_URING
+    for(int i = 0; i < iovcnt; i++)
+    {
+        int r = platUringQueueSend(pRconn, iov[i].iov_base, iov[i].iov_len);
+        if(r < 0) return r;
+        bytesWritten += r;
+        if(r < iov[i].iov_len) break;
+    }
+#else
+    bytesWritten = writev(pRconn->fd, iov, iovcnt);
+    if(bytesWritten < 0)
+    {
+        if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        {
+            // socket buffer is full, the rest is written on the next writable event
+            bytesWritten = 0;
+        } else
+        {
+            ESP_LOGE(TAG, "writev fd %d errno %d", pRconn->fd, errno);
+        }
+    }
+#endif
+
+#ifdef HTTPD_USE_CONN_EVENTS
+    platUpdateConnEvents(pRconn);
+#endif
+
+    return bytesWritten;
+}
+
+bool ICACHE_FLASH_ATTR httpdPlatCanSendFile(HttpdInstance *pInstance, HttpdConnData *pConn) {
+#ifdef linux
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    // with kernel tls the kernel also encrypts what sendfile() sends
+    if(platSslWrites(fr_of_instance(pInstance), frconn_of_conn(pConn))) return false;
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+int ICACHE_FLASH_ATTR httpdPlatSendFile(HttpdInstance *pInstance, HttpdConnData *pConn, int fd, off_t *offset, size_t len) {
+#ifdef linux
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    pRconn->needWriteDoneNotif=1;
+
+#ifdef HTTPD_USE_IO_URING
+    // the file goes after the data that is still waiting for its send request
+    if(pRconn->uringSendLen > 0)
+    {
+        platUpdateConnEvents(pRconn);
+        return 0;
+    }
+#endif
+
+    ssize_t bytesWritten = sendfile(pRconn->fd, fd, offset, len);
+    if(bytesWritten < 0)
+    {
+        if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        {
+            bytesWritten = 0;
+        } else
+        {
+            ESP_LOGE(TAG, "sendfile fd %d errno %d", pRconn->fd, errno);
+        }
+    }
+
+#ifdef HTTPD_USE_CONN_EVENTS
+    platUpdateConnEvents(pRconn);
+#endif
 
     return bytesWritten;
+#else
+    return -1;
+#endif
 }
 
 void ICACHE_FLASH_ATTR httpdPlatDisconnect(HttpdConnData *pConn) {
     RtosConnType *pRconn = frconn_of_conn(pConn);
     pRconn->needsClose=1;
     pRconn->needWriteDoneNotif=1; //because the real close is done in the writable select code
+#ifdef HTTPD_USE_CONN_EVENTS
+    platUpdateConnEvents(pRconn);
+#endif
 }
 
 void httpdPlatDisableTimeout(HttpdConnData *pConn) {
-    //Unimplemented for FreeRTOS
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    // the timer is disarmed when the server task updates the deadline after the current event
+    pRconn->noTimeout = true;
 }
 
 #ifdef linux
@@ -86,6 +391,22 @@ void ICACHE_FLASH_ATTR httpdPlatUnlock(HttpdInstance *pInstance) {
     HttpdFreertosInstance *pFR = fr_of_instance(pInstance);
     pthread_mutex_unlock(&pFR->httpdMux);
 }
+
+//Set/clear per-connection lock.
+void ICACHE_FLASH_ATTR httpdPlatConnLock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    pthread_mutex_lock(&pRconn->connMux);
+}
+
+void ICACHE_FLASH_ATTR httpdPlatConnUnlock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    pthread_mutex_unlock(&pRconn->connMux);
+}
+
+bool ICACHE_FLASH_ATTR httpdPlatConnTryLock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    return pthread_mutex_trylock(&pRconn->connMux) == 0;
+}
 #else
 //Set/clear global httpd lock.
 void ICACHE_FLASH_ATTR httpdPlatLock(HttpdInstance *pInstance) {
@@ -97,14 +418,57 @@ void ICACHE_FLASH_ATTR httpdPlatUnlock(HttpdInstance *pInstance) {
     HttpdFreertosInstance *pFR = fr_of_instance(pInstance);
     xSemaphoreGiveRecursive(pFR->httpdMux);
 }
+
+//Set/clear per-connection lock.
+void ICACHE_FLASH_ATTR httpdPlatConnLock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    xSemaphoreTakeRecursive(pRconn->connMux, portMAX_DELAY);
+}
+
+void ICACHE_FLASH_ATTR httpdPlatConnUnlock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    xSemaphoreGiveRecursive(pRconn->connMux);
+}
+
+bool ICACHE_FLASH_ATTR httpdPlatConnTryLock(HttpdConnData *pConn) {
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    return xSemaphoreTakeRecursive(pRconn->connMux, 0) == pdTRUE;
+}
 #endif
 
 void closeConnection(HttpdFreertosInstance *pInstance, RtosConnType *rconn)
 {
-    httpdDisconCb(&pInstance->httpdInstance, &rconn->connData);
+    // hold the connection lock until the fd is released so other threads
+    // can't send on a closed or re-used socket
+    httpdPlatConnLock(&rconn->connData);
 
+    bool httpAttached = true;
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-    if(pInstance->httpdFlags & HTTPD_FLAG_SSL)
+    httpAttached = !rconn->sslHandshaking;
+#endif
+    if(httpAttached)
+    {
+        httpdDisconCb(&pInstance->httpdInstance, &rconn->connData);
+    }
+
+    if(rconn->ctx)
+    {
+        httpdTimerDisarm(&rconn->ctx->timers, &rconn->timeout);
+    }
+    rconn->timeoutKind = HTTPD_TIMEOUT_NONE;
+
+#ifdef HTTPD_USE_EPOLL
+    if(rconn->ctx)
+    {
+        epoll_ctl(rconn->ctx->epollFd, EPOLL_CTL_DEL, rconn->fd, NULL);
+        rconn->ctx->activeConnections--;
+    }
+    rconn->epollEvents = 0;
+#endif
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    // there is no session to shut down before the handshake completed
+    if((pInstance->httpdFlags & HTTPD_FLAG_SSL) && !rconn->sslHandshaking)
     {
         int retval;
         retval = SSL_shutdown(rconn->ssl);
@@ -122,8 +486,20 @@ void closeConnection(HttpdFreertosInstance *pInstance, RtosConnType *rconn)
     }
 #endif
 
+#ifdef HTTPD_USE_IO_URING
+    // requests still in flight complete once the socket is shut down, the slot is free again
+    // when the last of them has completed
+    shutdown(rconn->fd, SHUT_RDWR);
+    rconn->uringSendLen = 0;
+    if(rconn->ctx && (rconn->uringArmed == 0))
+    {
+        rconn->ctx->activeConnections--;
+    }
+#endif
+
     close(rconn->fd);
     rconn->fd=-1;
+    rconn->generation++; // drops a resume that is still queued for this connection
 
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
     if(pInstance->httpdFlags & HTTPD_FLAG_SSL)
@@ -132,65 +508,550 @@ void closeConnection(HttpdFreertosInstance *pInstance, RtosConnType *rconn)
         ESP_LOGD(TAG, "SSL_free() complete");
         rconn->ssl = 0;
     }
+    rconn->sslHandshaking = false;
+    rconn->ktlsSend = false;
+    rconn->sslWriteWantsRead = false;
 #endif
+
+    httpdPlatConnUnlock(&rconn->connData);
 }
 
+/**
+ * Deadline that applies to the connection, a connection still in the tls handshake has no
+ * http state yet
+ */
+static HttpdTimeoutKind platConnTimeoutKind(RtosConnType *pRconn)
+{
+    if(pRconn->noTimeout) return HTTPD_TIMEOUT_NONE;
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-static SSL_CTX* sslCreateContext()
+    if(pRconn->sslHandshaking) return HTTPD_TIMEOUT_HANDSHAKE;
+#endif
+    return httpdConnTimeoutKind(&pRconn->connData);
+}
+
+/**
+ * Bring the deadline of a connection in line with its state
+ *
+ * Called by the server task after it handled events of the connection. The header and
+ * keep-alive deadlines run from the moment the connection entered that state, body and write
+ * deadlines are pushed back whenever the connection was readable or writable respectively.
+ */
+static void platUpdateConnTimeout(ServerTaskContext *ctx, RtosConnType *pRconn, bool readable, bool writable)
 {
-    SSL_CTX *ctx = NULL;
+    if(pRconn->fd == -1) return;
 
-    ESP_LOGI(TAG, "SSL server context create ......");
+    httpdPlatConnLock(&pRconn->connData);
+    HttpdTimeoutKind kind = platConnTimeoutKind(pRconn);
+    bool progress = ((kind == HTTPD_TIMEOUT_BODY) && readable) || ((kind == HTTPD_TIMEOUT_WRITE) && writable);
 
-    ctx = SSL_CTX_new(TLS_server_method());
-    if (!ctx) {
-        ESP_LOGE(TAG, "SSL_CXT_new");
+    if((kind != pRconn->timeoutKind) || progress)
+    {
+        pRconn->timeoutKind = kind;
+        int timeoutMs = ctx->pInstance->timeoutMs[kind];
+        if((kind != HTTPD_TIMEOUT_NONE) && (timeoutMs > 0))
+        {
+            httpdTimerArm(&ctx->timers, &pRconn->timeout, platTimeMs(), timeoutMs);
+        } else
+        {
+            httpdTimerDisarm(&ctx->timers, &pRconn->timeout);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+
+static void platConnTimeoutCb(HttpdTimer *timer, void *arg)
+{
+    RtosConnType *pRconn = arg;
+    ServerTaskContext *ctx = pRconn->ctx;
+
+    httpdPlatConnLock(&pRconn->connData);
+    HttpdTimeoutKind kind = platConnTimeoutKind(pRconn);
+    if((kind != HTTPD_TIMEOUT_NONE) && (kind == pRconn->timeoutKind))
+    {
+        ESP_LOGW(TAG, "%s timeout, closing fd %d", timeoutNames[kind], pRconn->fd);
+        closeConnection(ctx->pInstance, pRconn);
     } else
     {
-        ESP_LOGI(TAG, "OK");
+        // the state changed from outside of the server task since the timer was armed
+        platUpdateConnTimeout(ctx, pRconn, false, false);
     }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
 
-    return ctx;
+#ifdef HTTPD_USE_EPOLL
+/**
+ * Arm the timerfd of the server task to the next deadline of its timer wheel
+ */
+static void platUpdateTimerFd(ServerTaskContext *ctx)
+{
+    uint64_t now = platTimeMs();
+    int timeoutMs = httpdTimerWheelTimeoutMs(&ctx->timers, now);
+    uint64_t deadline = (timeoutMs < 0) ? 0 : now + timeoutMs;
+    if(deadline == ctx->timerFdDeadline) return;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000;
+    its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    if(timerfd_settime(ctx->timerFd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+    {
+        ESP_LOGE(TAG, "timerfd_settime errno %d", errno);
+        return;
+    }
+    ctx->timerFdDeadline = deadline;
 }
+#endif
 
 /**
- * @return true if successful, false otherwise
+ * Create the wakeup fd and reset the command queue of a server task
+ *
+ * Done before the server task runs so commands can be posted right away.
  */
-static bool sslSetDerCertificateAndKey(HttpdFreertosInstance *pInstance,
-                                        const void *certificate, size_t certificate_size,
-                                        const void *private_key, size_t private_key_size)
+static void platCommandQueueInit(ServerTaskContext *ctx)
 {
-    bool status = true;
+    ctx->cmdQueue = NULL;
+    ctx->shutdownCmd.next = NULL;
+    ctx->shutdownCmd.type = HTTPD_PLAT_CMD_SHUTDOWN;
+    ctx->wakeFd = -1;
 
-    ESP_LOGI(TAG, "SSL server context setting ca certificate......");
-    int ret = SSL_CTX_use_certificate_ASN1(pInstance->ctx, certificate_size, certificate);
-    if (!ret) {
 #ifdef linux
-        ERR_print_errors_fp(stderr);
-#endif
-        ESP_LOGE(TAG, "SSL_CTX_use_certificate_ASN1 %d", ret);
-        status = false;
+    ctx->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif defined(HTTPD_WAKE_EVENTFD)
+    // the application may have registered the eventfd driver already
+    esp_vfs_eventfd_config_t eventfdConfig = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&eventfdConfig);
+    if((err != ESP_OK) && (err != ESP_ERR_INVALID_STATE))
+    {
+        ESP_LOGE(TAG, "esp_vfs_eventfd_register %d", err);
     }
-    ESP_LOGI(TAG, "OK");
-
-    ESP_LOGI(TAG, "SSL server context setting private key......");
-    ret = SSL_CTX_use_RSAPrivateKey_ASN1(pInstance->ctx, private_key, private_key_size);
-    if (!ret) {
-#ifdef linux
-        ERR_print_errors_fp(stderr);
+    ctx->wakeFd = eventfd(0, 0);
 #endif
-        ESP_LOGE(TAG, "SSL_CTX_use_RSAPrivateKey_ASN1 %d", ret);
-        status = false;
+#ifdef HTTPD_WAKE_EVENTFD
+    if(ctx->wakeFd < 0)
+    {
+        ESP_LOGE(TAG, "eventfd errno %d", errno);
     }
+#endif
+}
 
-    return status;
+/**
+ * Make the wakeup fd readable
+ */
+static void platWake(ServerTaskContext *ctx)
+{
+#ifdef HTTPD_WAKE_EVENTFD
+    uint64_t one = 1;
+    if(write(ctx->wakeFd, &one, sizeof(one)) < 0)
+    {
+        // EAGAIN only happens when the counter is about to overflow, the task wakes up anyway
+    }
+#endif
 }
 
+/**
+ * Consume the pending wakeups, called before the queue is taken
+ */
+static void platWakeDrain(ServerTaskContext *ctx)
+{
+#ifdef HTTPD_WAKE_EVENTFD
+    uint64_t count;
+    if(read(ctx->wakeFd, &count, sizeof(count)) < 0) { /* spurious wakeup */ }
 #endif
+}
 
-#ifdef linux
+/**
+ * Queue a command for a server task, may be called from any thread
+ *
+ * Only the post that finds the queue empty has to wake the task up, the others are taken
+ * along with it.
+ */
+static void platPostCommand(ServerTaskContext *ctx, HttpdPlatCmd *cmd)
+{
+    HttpdPlatCmd *head = __atomic_load_n(&ctx->cmdQueue, __ATOMIC_RELAXED);
+    do
+    {
+        cmd->next = head;
+    } while(!__atomic_compare_exchange_n(&ctx->cmdQueue, &head, cmd, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
-#define PLAT_TASK_EXIT return NULL
+    if(head == NULL)
+    {
+        platWake(ctx);
+    }
+}
+
+static void platHandleResume(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    // clear the flag first, a resume requested while the cgi runs queues the command again
+    __atomic_store_n(&pRconn->resumeQueued, 0, __ATOMIC_SEQ_CST);
+    unsigned int generation = __atomic_load_n(&pRconn->resumeGeneration, __ATOMIC_ACQUIRE);
+
+    httpdPlatConnLock(&pRconn->connData);
+    if((pRconn->fd != -1) && (generation == pRconn->generation))
+    {
+        if(httpdContinue(&ctx->pInstance->httpdInstance, &pRconn->connData) != CallbackSuccess)
+        {
+            closeConnection(ctx->pInstance, pRconn);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+
+    if(pRconn->fd != -1)
+    {
+#ifdef HTTPD_USE_CONN_EVENTS
+        platUpdateConnEvents(pRconn);
+#endif
+        platUpdateConnTimeout(ctx, pRconn, false, false);
+    }
+}
+
+#ifdef HTTPD_USE_IO_URING
+static void platHandleUpdateEvents(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    __atomic_store_n(&pRconn->eventsQueued, 0, __ATOMIC_SEQ_CST);
+    platUringArmConn(ctx, pRconn);
+}
+#endif
+
+/**
+ * Run the commands posted to the server task, in the order they were posted
+ */
+static void platHandleCommands(ServerTaskContext *ctx)
+{
+    platWakeDrain(ctx);
+
+    HttpdPlatCmd *list = __atomic_exchange_n(&ctx->cmdQueue, NULL, __ATOMIC_ACQUIRE);
+
+    // the queue is a stack, reverse it
+    HttpdPlatCmd *ordered = NULL;
+    while(list)
+    {
+        HttpdPlatCmd *cmd = list;
+        list = cmd->next;
+        cmd->next = ordered;
+        ordered = cmd;
+    }
+
+    while(ordered)
+    {
+        HttpdPlatCmd *cmd = ordered;
+        // take next before running the command, it may be posted again right away
+        ordered = cmd->next;
+
+        switch(cmd->type)
+        {
+        case HTTPD_PLAT_CMD_RESUME:
+            platHandleResume(ctx, esp_container_of(cmd, RtosConnType, resumeCmd));
+            break;
+        case HTTPD_PLAT_CMD_SHUTDOWN:
+            ctx->shutdown = true;
+            ESP_LOGI(TAG, "shutting down");
+            break;
+        case HTTPD_PLAT_CMD_UPDATE_EVENTS:
+#ifdef HTTPD_USE_IO_URING
+            platHandleUpdateEvents(ctx, esp_container_of(cmd, RtosConnType, eventsCmd));
+#endif
+            break;
+        }
+    }
+}
+
+void httpdPlatContinueAsync(HttpdInstance *pInstance, HttpdConnData *pConn)
+{
+    RtosConnType *pRconn = frconn_of_conn(pConn);
+    ServerTaskContext *ctx = pRconn->ctx;
+    if(ctx == NULL) return;
+
+    __atomic_store_n(&pRconn->resumeGeneration, pRconn->generation, __ATOMIC_RELEASE);
+    if(__atomic_exchange_n(&pRconn->resumeQueued, 1, __ATOMIC_SEQ_CST))
+    {
+        return; // already queued
+    }
+    platPostCommand(ctx, &pRconn->resumeCmd);
+}
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+static SSL_CTX* sslCreateContext()
+{
+    SSL_CTX *ctx = NULL;
+
+    ESP_LOGI(TAG, "SSL server context create ......");
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        ESP_LOGE(TAG, "SSL_CXT_new");
+    } else
+    {
+        ESP_LOGI(TAG, "OK");
+#ifdef SSL_MODE_ENABLE_PARTIAL_WRITE
+        // sockets are non-blocking, let SSL_write() report partial writes and allow a retry
+        // from the compacted send buffer
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#endif
+    }
+
+    return ctx;
+}
+
+/**
+ * @return true if successful, false otherwise
+ */
+static bool sslSetDerCertificateAndKey(HttpdFreertosInstance *pInstance,
+                                        const void *certificate, size_t certificate_size,
+                                        const void *private_key, size_t private_key_size)
+{
+    bool status = true;
+
+    ESP_LOGI(TAG, "SSL server context setting ca certificate......");
+    int ret = SSL_CTX_use_certificate_ASN1(pInstance->ctx, certificate_size, certificate);
+    if (!ret) {
+#ifdef linux
+        ERR_print_errors_fp(stderr);
+#endif
+        ESP_LOGE(TAG, "SSL_CTX_use_certificate_ASN1 %d", ret);
+        status = false;
+    }
+    ESP_LOGI(TAG, "OK");
+
+    ESP_LOGI(TAG, "SSL server context setting private key......");
+    ret = SSL_CTX_use_RSAPrivateKey_ASN1(pInstance->ctx, private_key, private_key_size);
+    if (!ret) {
+#ifdef linux
+        ERR_print_errors_fp(stderr);
+#endif
+        ESP_LOGE(TAG, "SSL_CTX_use_RSAPrivateKey_ASN1 %d", ret);
+        status = false;
+    }
+
+    return status;
+}
+
+#ifdef HTTPD_SSL_SESSION_RESUMPTION
+/**
+ * Replace the current ticket key once it is older than the key lifetime
+ *
+ * NOTE: must be called with the instance lock held
+ */
+static bool sslRotateTicketKeys(HttpdFreertosInstance *pInstance, uint64_t now)
+{
+    HttpdSslTicketKey *current = &pInstance->ticketKeys[0];
+    uint64_t lifetimeMs = (uint64_t)pInstance->ticketKeyLifetimeS * 1000;
+
+    if(current->valid && (now - current->createdMs < lifetimeMs)) return true;
+
+    // tickets of the previous key stay valid for one more lifetime
+    pInstance->ticketKeys[1] = *current;
+    pInstance->ticketKeys[1].valid = current->valid && (now - current->createdMs < 2 * lifetimeMs);
+
+    if((RAND_bytes(current->name, sizeof(current->name)) != 1) ||
+        (RAND_bytes(current->aesKey, sizeof(current->aesKey)) != 1) ||
+        (RAND_bytes(current->hmacKey, sizeof(current->hmacKey)) != 1))
+    {
+        ESP_LOGE(TAG, "RAND_bytes ticket key");
+        current->valid = false;
+        return false;
+    }
+    current->createdMs = now;
+    current->valid = true;
+    ESP_LOGD(TAG, "new session ticket key");
+    return true;
+}
+
+/**
+ * Get a copy of the key to encrypt a new ticket with (name NULL) or of the key a received
+ * ticket was encrypted with
+ *
+ * @param pRenew set if the ticket should be replaced by one of the current key
+ * @return false if there is no such key
+ */
+static bool sslGetTicketKey(HttpdFreertosInstance *pInstance, const unsigned char *name,
+                            HttpdSslTicketKey *pKey, bool *pRenew)
+{
+    bool found = false;
+
+    httpdPlatLock(&pInstance->httpdInstance);
+    if(sslRotateTicketKeys(pInstance, platTimeMs()))
+    {
+        for(int i = 0; i < 2; i++)
+        {
+            HttpdSslTicketKey *key = &pInstance->ticketKeys[i];
+            if(key->valid && (!name || (memcmp(name, key->name, sizeof(key->name)) == 0)))
+            {
+                *pKey = *key;
+                if(pRenew) *pRenew = (i != 0);
+                found = true;
+                break;
+            }
+        }
+    }
+    httpdPlatUnlock(&pInstance->httpdInstance);
+
+    return found;
+}
+
+/**
+ * Set up the cipher and mac of a session ticket, called by openssl when it issues a ticket
+ * (enc 1) or receives one (enc 0)
+ *
+ * @return 1 on success, 2 if a received ticket should be renewed, 0 if the key of a received
+ *         ticket is unknown (a full handshake follows), -1 on error
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int sslTicketKeyCb(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                            EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int enc)
+#else
+static int sslTicketKeyCb(SSL *ssl, unsigned char *keyName, unsigned char *iv,
+                            EVP_CIPHER_CTX *cipherCtx, HMAC_CTX *macCtx, int enc)
+#endif
+{
+    HttpdFreertosInstance *pInstance = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    HttpdSslTicketKey key;
+    bool renew = false;
+    int ret;
+
+    if(enc)
+    {
+        if(!sslGetTicketKey(pInstance, NULL, &key, NULL)) return -1;
+        memcpy(keyName, key.name, sizeof(key.name));
+        if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+        ret = EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), NULL, key.aesKey, iv) ? 1 : -1;
+    } else
+    {
+        if(!sslGetTicketKey(pInstance, keyName, &key, &renew)) return 0;
+        ret = EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), NULL, key.aesKey, iv) ? (renew ? 2 : 1) : -1;
+    }
+
+    if(ret > 0)
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if(!EVP_MAC_CTX_set_params(macCtx, params)) ret = -1;
+#else
+        if(!HMAC_Init_ex(macCtx, key.hmacKey, sizeof(key.hmacKey), EVP_sha256(), NULL)) ret = -1;
+#endif
+    }
+
+    OPENSSL_cleanse(&key, sizeof(key));
+    return ret;
+}
+#endif
+
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+
+/*
+ * Every request carries the operation, the low bits of the connection generation and the
+ * connection index in its user_data, see PLAT_URING_DATA
+ */
+enum {
+    PLAT_URING_OP_ACCEPT,       // accept on the listening socket
+    PLAT_URING_OP_WAKE,         // multishot poll on the wakeup fd
+    PLAT_URING_OP_RECV,         // multishot receive into the provided buffers, non-ssl connections
+    PLAT_URING_OP_POLLIN,       // readable poll, ssl connections read through SSL_read()
+    PLAT_URING_OP_POLLOUT,      // writable poll, for write done notifications without a send request
+    PLAT_URING_OP_SEND          // send of the connection send buffer
+};
+
+#define PLAT_URING_DATA(op, generation, index) \
+    (((uint64_t)(op) << 56) | ((uint64_t)((generation) & 0xffffff) << 32) | (uint32_t)(index))
+#define PLAT_URING_DATA_OP(data) ((int)((data) >> 56))
+#define PLAT_URING_DATA_GENERATION(data) ((unsigned int)((data) >> 32) & 0xffffff)
+#define PLAT_URING_DATA_INDEX(data) ((uint32_t)(data))
+
+// bit of an operation in RtosConnType.uringArmed
+#define PLAT_URING_ARMED(op) (1 << (op))
+
+#define PLAT_URING_BUF_GROUP 0
+
+static void platUringArmWake(ServerTaskContext *ctx)
+{
+    struct io_uring_sqe *sqe = httpdUringGetSqe(&ctx->ring);
+    if(!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ctx->wakeFd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = PLAT_URING_DATA(PLAT_URING_OP_WAKE, 0, 0);
+}
+
+static void platUringSubmit(ServerTaskContext *ctx, RtosConnType *pRconn, int op)
+{
+    struct io_uring_sqe *sqe = httpdUringGetSqe(&ctx->ring);
+    if(!sqe)
+    {
+        ESP_LOGE(TAG, "io_uring submission queue full");
+        return;
+    }
+
+    sqe->fd = pRconn->fd;
+    switch(op)
+    {
+    case PLAT_URING_OP_RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = PLAT_URING_BUF_GROUP;
+        break;
+    case PLAT_URING_OP_POLLIN:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+        break;
+    case PLAT_URING_OP_POLLOUT:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+        break;
+    case PLAT_URING_OP_SEND:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)pRconn->uringSendBuf;
+        sqe->len = pRconn->uringSendLen;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    }
+    sqe->user_data = PLAT_URING_DATA(op, pRconn->generation, pRconn - ctx->pInstance->rconn);
+    pRconn->uringArmed |= PLAT_URING_ARMED(op);
+}
+
+/**
+ * Submit the requests the connection is missing: a receive request (or a readable poll for
+ * ssl connections that read through SSL_read()), a send request while the send buffer holds
+ * data and a writable poll when a write done notification is needed without a send request
+ */
+static void platUringArmConn(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    httpdPlatConnLock(&pRconn->connData);
+    if(pRconn->fd != -1)
+    {
+        int readOp = PLAT_URING_OP_RECV;
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+        if(ctx->pInstance->httpdFlags & HTTPD_FLAG_SSL) readOp = PLAT_URING_OP_POLLIN;
+#endif
+        if(!(pRconn->uringArmed & PLAT_URING_ARMED(readOp)))
+        {
+            platUringSubmit(ctx, pRconn, readOp);
+        }
+
+        if((pRconn->uringSendLen > 0) && !(pRconn->uringArmed & PLAT_URING_ARMED(PLAT_URING_OP_SEND)))
+        {
+            platUringSubmit(ctx, pRconn, PLAT_URING_OP_SEND);
+        }
+
+        if(pRconn->needWriteDoneNotif &&
+            !(pRconn->uringArmed & (PLAT_URING_ARMED(PLAT_URING_OP_SEND) | PLAT_URING_ARMED(PLAT_URING_OP_POLLOUT))))
+        {
+            platUringSubmit(ctx, pRconn, PLAT_URING_OP_POLLOUT);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+
+#endif
+
+#ifdef linux
+
+#define PLAT_TASK_EXIT return NULL
 
 #else
 
@@ -214,53 +1075,85 @@ PLAT_RETURN platHttpServerTask(void *pvParameters)
     return platHttpServerTaskDeinit(&context);
 }
 
+static void platHttpServerWorkerInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInstance);
+
+/**
+ * Server task started by httpdFreertosStart(), serves the connection slice of its context
+ */
+static PLAT_RETURN platHttpServerWorkerTask(void *pvParameters)
+{
+    ServerTaskContext *ctx = (ServerTaskContext*)pvParameters;
+    platHttpServerWorkerInit(ctx, ctx->pInstance);
+
+    while(!ctx->shutdown)
+    {
+        platHttpServerTaskProcess(ctx);
+    }
+
+    return platHttpServerTaskDeinit(ctx);
+}
 
 /**
  * Manually init all data required for processing the server task
  */
 void platHttpServerTaskInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInstance) {
-    ctx->pInstance = pInstance;
+    ctx->connStart = 0;
+    ctx->connCount = pInstance->httpdInstance.maxConnections;
+
+    httpdPlatLock(&pInstance->httpdInstance);
+    pInstance->runningWorkers++;
+    pInstance->workers = ctx;
+    pInstance->workerCount = 1;
+    pInstance->workersAllocated = false;
+    httpdPlatUnlock(&pInstance->httpdInstance);
+
+    platCommandQueueInit(ctx);
+    platHttpServerWorkerInit(ctx, pInstance);
+}
 
-#ifdef linux
-    pthread_mutexattr_t mutexattr;
-    pthread_mutexattr_init(&mutexattr);
-    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&ctx->pInstance->httpdMux, &mutexattr);
-#else
-    ctx->pInstance->httpdMux = xSemaphoreCreateRecursiveMutex();
+/**
+ * Set the tcp keepalive and nodelay options of a connection
+ *
+ * On linux accepted connections inherit them from the listening socket, so this is done once
+ * for the listening socket instead of for every connection.
+ */
+static void platSetConnSocketOptions(int fd)
+{
+    int keepAlive = 1; //enable keepalive
+    int keepIdle = 60; //60s
+    int keepInterval = 5; //5s
+    int keepCount = 3; //retry times
+    int nodelay = 0;
+#ifdef CONFIG_ESPHTTPD_TCP_NODELAY
+    nodelay = 1;  // enable TCP_NODELAY to speed-up transfers of small files.  See Nagle's Algorithm.
 #endif
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepAlive, sizeof(keepAlive));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, (void*)&keepIdle, sizeof(keepIdle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, (void *)&keepInterval, sizeof(keepInterval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, (void *)&keepCount, sizeof(keepCount));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&nodelay, sizeof(nodelay));
+}
 
-    int idxConnection = 0;
-    for (idxConnection=0; idxConnection < ctx->pInstance->httpdInstance.maxConnections; idxConnection++) {
-        ctx->pInstance->rconn[idxConnection].fd=-1;
-    }
-
-#ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
-    static int currentUdpShutdownPort = 8000;
+/**
+ * Init a server task for the connection slice set in ctx
+ */
+static void platHttpServerWorkerInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInstance) {
+    ctx->pInstance = pInstance;
 
-    struct sockaddr_in udp_addr;
-    memset(&udp_addr, 0, sizeof(udp_addr)); /* Zero out structure */
-    udp_addr.sin_family = AF_INET;			/* Internet address family */
-    udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    #ifndef linux
-    udp_addr.sin_len = sizeof(udp_addr);
-    #endif
+    ctx->precvbuf = (char*)malloc(RECV_BUF_SIZE);
+    if(!ctx->precvbuf)
+    {
+        ESP_LOGE(TAG, "malloc precvbuf");
+    }
 
-    // FIXME: use and increment of currentUdpShutdownPort is not thread-safe
-    // and should use a mutex
-    ctx->pInstance->udpShutdownPort = currentUdpShutdownPort;
-    currentUdpShutdownPort++;
-    udp_addr.sin_port = htons(ctx->pInstance->udpShutdownPort);
+    httpdTimerWheelInit(&ctx->timers, platTimeMs());
 
-    ctx->udpListenFd = socket(AF_INET, SOCK_DGRAM, 0);
-    ESP_LOGI(TAG, "ctx->udpListenFd %d", ctx->udpListenFd);
-    if(bind(ctx->udpListenFd, (struct sockaddr *)&udp_addr, sizeof(udp_addr)) != 0)
-    {
-        ESP_LOGE(TAG, "udp bind failure");
-        PLAT_TASK_EXIT;
+    int idxConnection = 0;
+    for (idxConnection=ctx->connStart; idxConnection < ctx->connStart + ctx->connCount; idxConnection++) {
+        ctx->pInstance->rconn[idxConnection].fd=-1;
+        ctx->pInstance->rconn[idxConnection].ctx=ctx;
+        httpdTimerInit(&ctx->pInstance->rconn[idxConnection].timeout, platConnTimeoutCb, &ctx->pInstance->rconn[idxConnection]);
     }
-    ESP_LOGI(TAG, "shutdown bound to udp port %d", ctx->pInstance->udpShutdownPort);
-#endif
 
     /* Construct local address structure */
     struct sockaddr_in server_addr;
@@ -293,6 +1186,47 @@ void platHttpServerTaskInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInst
     }
 #endif
 
+#ifdef linux
+    // every worker binds its own listening socket to the same address, the kernel
+    // distributes incoming connections between them
+    if(ctx->pInstance->workerCount > 1)
+    {
+        int reusePort = 1;
+        if (setsockopt(ctx->listenFd, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(int)) < 0)
+        {
+            perror("setsockopt(SO_REUSEPORT) failed");
+        }
+    }
+#endif
+
+#ifdef linux
+    platSetConnSocketOptions(ctx->listenFd);
+
+    if(ctx->pInstance->deferAcceptS > 0)
+    {
+        // only wake up for connections once the client sent its request
+        if (setsockopt(ctx->listenFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &ctx->pInstance->deferAcceptS, sizeof(int)) < 0)
+        {
+            perror("setsockopt(TCP_DEFER_ACCEPT) failed");
+        }
+    }
+
+    if(ctx->pInstance->fastOpenQueueLen > 0)
+    {
+        if (setsockopt(ctx->listenFd, IPPROTO_TCP, TCP_FASTOPEN, &ctx->pInstance->fastOpenQueueLen, sizeof(int)) < 0)
+        {
+            perror("setsockopt(TCP_FASTOPEN) failed");
+        }
+    }
+#endif
+
+    // pending connections are accepted until accept() reports an empty backlog
+    int listenFlags = fcntl(ctx->listenFd, F_GETFL, 0);
+    if((listenFlags < 0) || (fcntl(ctx->listenFd, F_SETFL, listenFlags | O_NONBLOCK) < 0))
+    {
+        ESP_LOGE(TAG, "fcntl(O_NONBLOCK) listen fd %d", ctx->listenFd);
+    }
+
     /* Bind to the local port */
     int32 retBind = 0;
     do{
@@ -307,7 +1241,8 @@ void platHttpServerTaskInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInst
     int32 retListen = 0;
     do{
         /* Listen to the local connection */
-        retListen = listen(ctx->listenFd, ctx->pInstance->httpdInstance.maxConnections);
+        int backlog = (ctx->pInstance->listenBacklog > 0) ? ctx->pInstance->listenBacklog : ctx->connCount;
+        retListen = listen(ctx->listenFd, backlog);
         if (retListen != 0) {
             ESP_LOGE(TAG, "listen on fd %d", ctx->listenFd);
             perror("listen");
@@ -315,16 +1250,727 @@ void platHttpServerTaskInit(ServerTaskContext *ctx, HttpdFreertosInstance *pInst
         }
     } while(retListen != 0);
 
+#ifdef HTTPD_USE_EPOLL
+    ctx->activeConnections = 0;
+    ctx->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(ctx->epollFd < 0)
+    {
+        ESP_LOGE(TAG, "epoll_create1");
+        perror("epoll_create1");
+    }
+
+    // the listening socket is registered without events, platUpdateListening() enables
+    // it while there are free connection slots
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = &ctx->listenFd;
+    epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, ctx->listenFd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ctx->wakeFd;
+    epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, ctx->wakeFd, &ev);
+
+    ctx->timerFdDeadline = 0;
+    ctx->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(ctx->timerFd < 0)
+    {
+        ESP_LOGE(TAG, "timerfd_create");
+    } else
+    {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &ctx->timerFd;
+        epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, ctx->timerFd, &ev);
+    }
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+    ctx->activeConnections = 0;
+    ctx->acceptArmed = false;
+    ctx->loopThread = pthread_self();
+    if(!httpdUringInit(&ctx->ring, HTTPD_URING_ENTRIES))
+    {
+        ESP_LOGE(TAG, "io_uring setup errno %d", errno);
+        ctx->shutdown = true;
+        return;
+    } else if(!httpdUringSetupBuffers(&ctx->ring, PLAT_URING_BUF_GROUP, CONFIG_ESPHTTPD_IO_URING_RECV_BUFFERS, RECV_BUF_SIZE))
+    {
+        // the task can't receive anything without them
+        ESP_LOGE(TAG, "io_uring receive buffers errno %d", errno);
+        ctx->shutdown = true;
+        return;
+    }
+    platUringArmWake(ctx);
+#endif
+
     ESP_LOGI(TAG, "esphttpd: active and listening to connections on %s", ctx->serverStr);
     ctx->shutdown = false;
     ctx->listeningForNewConnections = false;
 }
 
 /**
- * Manually execute the server task loop function once
+ * Find a free connection slot of the server task
+ *
+ * @return NULL if all connections are in use
  */
-void platHttpServerTaskProcess(ServerTaskContext *ctx) {
-    // clear fdset, and set the select function wait time
+static RtosConnType *platFindFreeSlot(ServerTaskContext *ctx)
+{
+    int connEnd = ctx->connStart + ctx->connCount;
+    for(int idxConnection = ctx->connStart; idxConnection < connEnd; idxConnection++) {
+        RtosConnType *pSlot = &ctx->pInstance->rconn[idxConnection];
+#ifdef HTTPD_USE_IO_URING
+        // requests of the previous connection still refer to the slot
+        if (pSlot->uringArmed != 0) continue;
+#endif
+        if (pSlot->fd==-1) return pSlot;
+    }
+    return NULL;
+}
+
+/**
+ * Attach the connection accepted in ctx->remoteFd to a free slot
+ *
+ * @param remoteAddr peer address returned by accept()
+ */
+static void platAttachConnection(ServerTaskContext *ctx, RtosConnType *pRconn, const struct sockaddr_in *remoteAddr)
+{
+#ifndef linux
+    // lwip doesn't pass these on from the listening socket
+    platSetConnSocketOptions(ctx->remoteFd);
+#endif
+
+    pRconn->fd=ctx->remoteFd;
+    pRconn->needWriteDoneNotif=0;
+    pRconn->needsClose=0;
+    pRconn->ctx=ctx;
+    pRconn->noTimeout=false;
+    pRconn->timeoutKind=HTTPD_TIMEOUT_NONE;
+
+#ifndef linux
+    // writes never block the server task, data the socket doesn't take is kept in the
+    // connection send buffer until the socket is writable again. On linux accept4() already
+    // returns a non-blocking socket.
+    int fdFlags = fcntl(ctx->remoteFd, F_GETFL, 0);
+    if((fdFlags < 0) || (fcntl(ctx->remoteFd, F_SETFL, fdFlags | O_NONBLOCK) < 0))
+    {
+        ESP_LOGE(TAG, "fcntl(O_NONBLOCK) fd %d", ctx->remoteFd);
+    }
+#endif
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    pRconn->sslHandshaking = false;
+    pRconn->ktlsSend = false;
+    pRconn->sslWriteWantsRead = false;
+    if(ctx->pInstance->httpdFlags & HTTPD_FLAG_SSL)
+    {
+        ESP_LOGD(TAG, "SSL server create .....");
+        pRconn->ssl = SSL_new(ctx->pInstance->ctx);
+        if (!pRconn->ssl) {
+            ESP_LOGE(TAG, "SSL_new");
+            close(ctx->remoteFd);
+            pRconn->fd = -1;
+            return;
+        }
+        ESP_LOGD(TAG, "OK");
+
+        SSL_set_fd(pRconn->ssl, pRconn->fd);
+
+        // the handshake is driven by platSslHandshake() from the events of the socket
+        pRconn->sslHandshaking = true;
+    }
+#endif
+
+    pRconn->port = remoteAddr->sin_port;
+    memcpy(&pRconn->ip, &remoteAddr->sin_addr.s_addr, sizeof(pRconn->ip));
+
+#ifdef HTTPD_USE_EPOLL
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = pRconn;
+    if(epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, pRconn->fd, &ev) != 0)
+    {
+        ESP_LOGE(TAG, "epoll_ctl(ADD) fd %d", pRconn->fd);
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+        if(pRconn->ssl)
+        {
+            SSL_free(pRconn->ssl);
+            pRconn->ssl = 0;
+        }
+#endif
+        close(pRconn->fd);
+        pRconn->fd = -1;
+        return;
+    }
+    pRconn->epollEvents = ev.events;
+    ctx->activeConnections++;
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+    ctx->activeConnections++;
+    platUringArmConn(ctx, pRconn);
+#endif
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if(!pRconn->sslHandshaking)
+#endif
+    {
+        // NOTE: httpdConnectCb cannot fail
+        httpdConnectCb(&ctx->pInstance->httpdInstance, &pRconn->connData);
+    }
+    platUpdateConnTimeout(ctx, pRconn, false, false);
+}
+
+#ifndef HTTPD_USE_IO_URING
+/**
+ * Accept the pending connections of the listening socket into free slots
+ *
+ * Stops once the backlog is empty or all connections are in use, the remaining connections
+ * wait in the backlog until a slot is free again.
+ */
+static void platAcceptConnections(ServerTaskContext *ctx)
+{
+    RtosConnType *pRconn;
+    while((pRconn = platFindFreeSlot(ctx)) != NULL)
+    {
+        socklen_t len = sizeof(struct sockaddr_in);
+        struct sockaddr_in remote_addr;
+#ifdef linux
+        ctx->remoteFd = accept4(ctx->listenFd, (struct sockaddr *)&remote_addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        ctx->remoteFd = accept(ctx->listenFd, (struct sockaddr *)&remote_addr, &len);
+#endif
+        if (ctx->remoteFd<0) {
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            } else if((errno == ECONNABORTED) || (errno == EINTR))
+            {
+                // the client gave up before it was accepted
+                continue;
+            }
+            ESP_LOGE(TAG, "accept failed");
+            perror("accept");
+            break;
+        }
+
+        platAttachConnection(ctx, pRconn, &remote_addr);
+    }
+}
+#endif
+
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+/**
+ * Continue the tls handshake of a connection, called whenever its socket is ready
+ *
+ * SSL_accept() is retried until it completes, waiting for the socket to become readable or
+ * writable as it asks for. The http state of the connection is set up once it completes.
+ */
+static void platSslHandshake(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    httpdPlatConnLock(&pRconn->connData);
+    int32 retAcceptSSL = SSL_accept(pRconn->ssl);
+    if(retAcceptSSL == 1)
+    {
+        ESP_LOGD(TAG, "SSL_accept complete fd %d", pRconn->fd);
+        bool resumed = false;
+#ifdef HTTPD_SSL_SESSION_RESUMPTION
+        resumed = SSL_session_reused(pRconn->ssl);
+#endif
+        __atomic_fetch_add(resumed ? &ctx->pInstance->sslResumedHandshakes : &ctx->pInstance->sslFullHandshakes,
+                            1, __ATOMIC_RELAXED);
+        pRconn->sslHandshaking = false;
+        pRconn->needWriteDoneNotif = 0;
+#ifdef HTTPD_SSL_KTLS
+        pRconn->ktlsSend = BIO_get_ktls_send(SSL_get_wbio(pRconn->ssl));
+        ESP_LOGD(TAG, "fd %d ktls send %d", pRconn->fd, pRconn->ktlsSend);
+#endif
+        // NOTE: httpdConnectCb cannot fail
+        httpdConnectCb(&ctx->pInstance->httpdInstance, &pRconn->connData);
+    } else
+    {
+        int ssl_error = SSL_get_error(pRconn->ssl, retAcceptSSL);
+        if(ssl_error == SSL_ERROR_WANT_READ)
+        {
+            pRconn->needWriteDoneNotif = 0;
+        } else if(ssl_error == SSL_ERROR_WANT_WRITE)
+        {
+            pRconn->needWriteDoneNotif = 1;
+        } else
+        {
+            ESP_LOGE(TAG, "SSL_accept %d", ssl_error);
+            closeConnection(ctx->pInstance, pRconn);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+#endif
+
+/**
+ * The socket of a connection that asked for a write done notification is writable
+ */
+static void platHandleConnWritable(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    httpdPlatConnLock(&pRconn->connData);
+    pRconn->needWriteDoneNotif=0; //Do this first, httpdSentCb may write something making this 1 again.
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if (pRconn->sslHandshaking) {
+        platSslHandshake(ctx, pRconn);
+    } else
+#endif
+    if (pRconn->needsClose) {
+        //Do callback and close fd.
+        closeConnection(ctx->pInstance, pRconn);
+    }
+    else {
+        if(httpdSentCb(&ctx->pInstance->httpdInstance, &pRconn->connData) != CallbackSuccess) {
+            closeConnection(ctx->pInstance, pRconn);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+
+/**
+ * The socket of a connection has data available (or was closed by the peer)
+ */
+static void platHandleConnReadable(ServerTaskContext *ctx, RtosConnType *pRconn)
+{
+    httpdPlatConnLock(&pRconn->connData);
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if(pRconn->sslHandshaking)
+    {
+        platSslHandshake(ctx, pRconn);
+    } else if(ctx->pInstance->httpdFlags & HTTPD_FLAG_SSL)
+    {
+        int bytesStillAvailable;
+
+        if(pRconn->sslWriteWantsRead)
+        {
+            // resume the send that SSL_write() couldn't continue without data from the peer
+            pRconn->sslWriteWantsRead = false;
+            if(httpdSentCb(&ctx->pInstance->httpdInstance, &pRconn->connData) != CallbackSuccess)
+            {
+                closeConnection(ctx->pInstance, pRconn);
+                httpdPlatConnUnlock(&pRconn->connData);
+                return;
+            }
+        }
+
+        // NOTE: we repeat the call to SSL_read() and process data
+        // while SSL indicates there is still pending data.
+        //
+        // select() isn't detecting available data, this
+        // re-read approach resolves an issue where data is stuck in
+        // SSL internal buffers
+        do {
+            int32 retReadSSL = SSL_read(pRconn->ssl, ctx->precvbuf, RECV_BUF_SIZE - 1);
+
+            bytesStillAvailable = SSL_has_pending(pRconn->ssl);
+
+            if(retReadSSL <= 0)
+            {
+                int ssl_error = SSL_get_error(pRconn->ssl, retReadSSL);
+                if((ssl_error == SSL_ERROR_WANT_READ) || (ssl_error == SSL_ERROR_WANT_WRITE))
+                {
+                    // no complete record available yet on the non-blocking socket
+                    break;
+                } else if(ssl_error != SSL_ERROR_NONE)
+                {
+                    ESP_LOGE(TAG, "ssl_error %d, retReadSSL %d, bytesStillAvailable %d", ssl_error, retReadSSL, bytesStillAvailable);
+                } else
+                {
+                    ESP_LOGD(TAG, "ssl_error %d, retReadSSL %d, bytesStillAvailable %d", ssl_error, retReadSSL, bytesStillAvailable);
+                }
+            }
+
+            if (retReadSSL > 0) {
+                //Data received. Pass to httpd.
+                if(httpdRecvCb(&ctx->pInstance->httpdInstance, &pRconn->connData, &ctx->precvbuf[0], retReadSSL) != CallbackSuccess)
+                {
+                    closeConnection(ctx->pInstance, pRconn);
+                }
+            } else {
+                //recv error,connection close
+                closeConnection(ctx->pInstance, pRconn);
+            }
+        } while(bytesStillAvailable && pRconn->fd != -1);
+    } else
+    {
+#endif
+        int32 retRecv = recv(pRconn->fd, &ctx->precvbuf[0], RECV_BUF_SIZE, 0);
+
+        if ((retRecv < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+            // spurious wakeup, nothing to read
+        } else if (retRecv > 0) {
+            //Data received. Pass to httpd.
+            if(httpdRecvCb(&ctx->pInstance->httpdInstance, &pRconn->connData, &ctx->precvbuf[0], retRecv) != CallbackSuccess)
+            {
+                closeConnection(ctx->pInstance, pRconn);
+            }
+        } else {
+            //recv error,connection close
+            closeConnection(ctx->pInstance, pRconn);
+        }
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    }
+#endif
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+
+#ifdef HTTPD_USE_EPOLL
+
+/**
+ * Add or remove the listening socket from the epoll set depending on free connection slots
+ */
+static void platUpdateListening(ServerTaskContext *ctx)
+{
+    bool slotsAvailable = ctx->activeConnections < ctx->connCount;
+    if(slotsAvailable == ctx->listeningForNewConnections) return;
+
+    struct epoll_event ev;
+    ev.events = slotsAvailable ? EPOLLIN : 0;
+    ev.data.ptr = &ctx->listenFd;
+    if(epoll_ctl(ctx->epollFd, EPOLL_CTL_MOD, ctx->listenFd, &ev) != 0)
+    {
+        ESP_LOGE(TAG, "epoll_ctl(MOD) listen fd %d", ctx->listenFd);
+        return;
+    }
+
+    ctx->listeningForNewConnections = slotsAvailable;
+    if(slotsAvailable)
+    {
+        ESP_LOGI(TAG, "listening for new connections on '%s'", ctx->serverStr);
+    } else
+    {
+        ESP_LOGI(TAG, "all %d connections in use on '%s'", ctx->connCount, ctx->serverStr);
+    }
+}
+
+/**
+ * Manually execute the server task loop function once
+ *
+ * The connection sockets stay registered with the epoll set for their whole lifetime, only
+ * connections that epoll reports as ready are visited.
+ */
+void platHttpServerTaskProcess(ServerTaskContext *ctx) {
+    struct epoll_event events[HTTPD_EPOLL_MAX_EVENTS];
+    bool acceptPending = false;
+    bool commandsPending = false;
+    int timeoutMs = -1;
+
+    platUpdateListening(ctx);
+    platUpdateTimerFd(ctx);
+
+    if(ctx->selectTimeoutData)
+    {
+        timeoutMs = (ctx->selectTimeoutData->tv_sec * 1000) + (ctx->selectTimeoutData->tv_usec / 1000);
+    }
+
+    int retEpoll = epoll_wait(ctx->epollFd, events, HTTPD_EPOLL_MAX_EVENTS, timeoutMs);
+    ESP_LOGD(TAG, "epoll_wait %d", retEpoll);
+
+    for(int i = 0; i < retEpoll; i++)
+    {
+        void *ptr = events[i].data.ptr;
+
+        if(ptr == &ctx->timerFd)
+        {
+            uint64_t expirations;
+            if(read(ctx->timerFd, &expirations, sizeof(expirations)) < 0) { /* already consumed */ }
+            ctx->timerFdDeadline = 0;
+            continue;
+        }
+
+        if(ptr == &ctx->wakeFd)
+        {
+            commandsPending = true;
+            continue;
+        }
+
+        // accept after the connection events of this batch have been handled so a slot that
+        // was closed and re-used doesn't receive stale events
+        if(ptr == &ctx->listenFd)
+        {
+            acceptPending = true;
+            continue;
+        }
+
+        RtosConnType *pRconn = ptr;
+
+        //Skip connections that were closed while handling an earlier event of this batch
+        if (pRconn->fd == -1) { continue; }
+
+        //Check for write availability first: the read routines may write needWriteDoneNotif while
+        //epoll didn't check for that.
+        bool writable = pRconn->needWriteDoneNotif && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP));
+        if (writable) {
+            platHandleConnWritable(ctx, pRconn);
+        }
+
+        bool readable = (pRconn->fd != -1) && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP));
+        if (readable) {
+            platHandleConnReadable(ctx, pRconn);
+        }
+
+        if (pRconn->fd != -1) {
+            platUpdateConnEvents(pRconn);
+            platUpdateConnTimeout(ctx, pRconn, readable, writable);
+        }
+    }
+
+    if(commandsPending)
+    {
+        platHandleCommands(ctx);
+    }
+
+    if(acceptPending)
+    {
+        platAcceptConnections(ctx);
+    }
+
+    httpdTimerWheelAdvance(&ctx->timers, platTimeMs());
+}
+
+#elif defined(HTTPD_USE_IO_URING)
+
+/**
+ * Keep an accept request in flight while there are free connection slots
+ *
+ * A single accept is submitted at a time, so connections that find all slots in use wait in
+ * the backlog of the listening socket like they do with the other server loops.
+ */
+static void platUpdateListening(ServerTaskContext *ctx)
+{
+    bool slotsAvailable = ctx->activeConnections < ctx->connCount;
+
+    if(slotsAvailable && !ctx->acceptArmed)
+    {
+        struct io_uring_sqe *sqe = httpdUringGetSqe(&ctx->ring);
+        if(sqe)
+        {
+            ctx->acceptAddrLen = sizeof(ctx->acceptAddr);
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = ctx->listenFd;
+            sqe->addr = (uint64_t)(uintptr_t)&ctx->acceptAddr;
+            sqe->addr2 = (uint64_t)(uintptr_t)&ctx->acceptAddrLen;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            sqe->user_data = PLAT_URING_DATA(PLAT_URING_OP_ACCEPT, 0, 0);
+            ctx->acceptArmed = true;
+        }
+    }
+
+    if(slotsAvailable == ctx->listeningForNewConnections) return;
+
+    ctx->listeningForNewConnections = slotsAvailable;
+    if(slotsAvailable)
+    {
+        ESP_LOGI(TAG, "listening for new connections on '%s'", ctx->serverStr);
+    } else
+    {
+        ESP_LOGI(TAG, "all %d connections in use on '%s'", ctx->connCount, ctx->serverStr);
+    }
+}
+
+/**
+ * Data of a non-ssl connection arrived in a provided buffer
+ */
+static void platUringHandleRecv(ServerTaskContext *ctx, RtosConnType *pRconn, char *data, int len)
+{
+    httpdPlatConnLock(&pRconn->connData);
+    if(len > 0)
+    {
+        //Data received. Pass to httpd.
+        if(httpdRecvCb(&ctx->pInstance->httpdInstance, &pRconn->connData, data, len) != CallbackSuccess)
+        {
+            closeConnection(ctx->pInstance, pRconn);
+        }
+    } else
+    {
+        //recv error,connection close
+        closeConnection(ctx->pInstance, pRconn);
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+}
+
+/**
+ * A send request of a connection completed
+ *
+ * The sent data is dropped from the send buffer. A connection waiting for a write done
+ * notification gets it now, unless it is about to be closed and data is still left.
+ */
+static bool platUringHandleSend(ServerTaskContext *ctx, RtosConnType *pRconn, int res)
+{
+    bool writable = false;
+
+    httpdPlatConnLock(&pRconn->connData);
+    if(res < 0)
+    {
+        ESP_LOGE(TAG, "send fd %d errno %d", pRconn->fd, -res);
+        closeConnection(ctx->pInstance, pRconn);
+    } else
+    {
+        pRconn->uringSendLen -= res;
+        memmove(pRconn->uringSendBuf, pRconn->uringSendBuf + res, pRconn->uringSendLen);
+
+        writable = pRconn->needWriteDoneNotif && !(pRconn->needsClose && (pRconn->uringSendLen > 0));
+        if(writable)
+        {
+            platHandleConnWritable(ctx, pRconn);
+        }
+    }
+    httpdPlatConnUnlock(&pRconn->connData);
+
+    return writable;
+}
+
+static void platUringHandleCompletion(ServerTaskContext *ctx, const struct io_uring_cqe *cqe, bool *commandsPending)
+{
+    int op = PLAT_URING_DATA_OP(cqe->user_data);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    switch(op)
+    {
+    case PLAT_URING_OP_ACCEPT:
+        ctx->acceptArmed = false;
+        if(cqe->res >= 0)
+        {
+            ctx->remoteFd = cqe->res;
+            RtosConnType *pRconn = platFindFreeSlot(ctx);
+            if(pRconn)
+            {
+                platAttachConnection(ctx, pRconn, &ctx->acceptAddr);
+            } else
+            {
+                ESP_LOGE(TAG, "all connections in use, closing fd");
+                close(ctx->remoteFd);
+            }
+            // accept the next connection along with the requests of this one
+            platUpdateListening(ctx);
+        } else
+        {
+            ESP_LOGE(TAG, "accept failed, errno %d", -cqe->res);
+        }
+        return;
+    case PLAT_URING_OP_WAKE:
+        if(!more) platUringArmWake(ctx);
+        *commandsPending = true;
+        return;
+    }
+
+    RtosConnType *pRconn = &ctx->pInstance->rconn[PLAT_URING_DATA_INDEX(cqe->user_data)];
+    if(!more)
+    {
+        pRconn->uringArmed &= ~PLAT_URING_ARMED(op);
+    }
+
+    char *data = NULL;
+    if(cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        data = httpdUringBuffer(&ctx->ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    if((pRconn->fd == -1) || (PLAT_URING_DATA_GENERATION(cqe->user_data) != (pRconn->generation & 0xffffff)))
+    {
+        // request of a closed connection, its slot is free once the last one completed
+        if((pRconn->fd == -1) && !more && (pRconn->uringArmed == 0))
+        {
+            ctx->activeConnections--;
+        }
+    } else
+    {
+        bool readable = false;
+        bool writable = false;
+
+        switch(op)
+        {
+        case PLAT_URING_OP_RECV:
+            // out of provided buffers, the request is submitted again below
+            if(cqe->res != -ENOBUFS)
+            {
+                readable = true;
+                platUringHandleRecv(ctx, pRconn, data, cqe->res);
+            }
+            break;
+        case PLAT_URING_OP_POLLIN:
+            readable = true;
+            platHandleConnReadable(ctx, pRconn);
+            break;
+        case PLAT_URING_OP_POLLOUT:
+            writable = pRconn->needWriteDoneNotif;
+            if(writable)
+            {
+                platHandleConnWritable(ctx, pRconn);
+            }
+            break;
+        case PLAT_URING_OP_SEND:
+            writable = platUringHandleSend(ctx, pRconn, cqe->res);
+            break;
+        }
+
+        if(pRconn->fd != -1)
+        {
+            platUringArmConn(ctx, pRconn);
+            platUpdateConnTimeout(ctx, pRconn, readable, writable);
+        }
+    }
+
+    if(data)
+    {
+        httpdUringRecycleBuffer(&ctx->ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+}
+
+/**
+ * Manually execute the server task loop function once
+ *
+ * The requests collected while handling the previous completions are submitted with the same
+ * system call that waits for the next ones, which are then taken from the completion queue in
+ * bulk.
+ */
+void platHttpServerTaskProcess(ServerTaskContext *ctx) {
+    struct io_uring_cqe cqes[HTTPD_URING_MAX_CQES];
+    bool commandsPending = false;
+
+    platUpdateListening(ctx);
+
+    // wake up for the next connection deadline if that is earlier than the configured timeout
+    int timeoutMs = httpdTimerWheelTimeoutMs(&ctx->timers, platTimeMs());
+    if(ctx->selectTimeoutData)
+    {
+        int selectTimeoutMs = (ctx->selectTimeoutData->tv_sec * 1000) + (ctx->selectTimeoutData->tv_usec / 1000);
+        if((timeoutMs < 0) || (selectTimeoutMs < timeoutMs)) timeoutMs = selectTimeoutMs;
+    }
+
+    int retSubmit = httpdUringSubmitAndWait(&ctx->ring, timeoutMs);
+    if(retSubmit < 0)
+    {
+        ESP_LOGE(TAG, "io_uring_enter errno %d", -retSubmit);
+    }
+
+    unsigned int count;
+    do
+    {
+        count = httpdUringReap(&ctx->ring, cqes, HTTPD_URING_MAX_CQES);
+        ESP_LOGD(TAG, "io_uring completions %u", count);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            platUringHandleCompletion(ctx, &cqes[i], &commandsPending);
+        }
+    } while(count == HTTPD_URING_MAX_CQES);
+
+    if(commandsPending)
+    {
+        platHandleCommands(ctx);
+    }
+
+    httpdTimerWheelAdvance(&ctx->timers, platTimeMs());
+}
+
+#else
+
+/**
+ * Manually execute the server task loop function once
+ */
+void platHttpServerTaskProcess(ServerTaskContext *ctx) {
+    // clear fdset, and set the select function wait time
     fd_set readset,writeset;
     int socketsFull = 1;
     int maxfdp = 0;
@@ -332,7 +1978,7 @@ void platHttpServerTaskProcess(ServerTaskContext *ctx) {
     FD_ZERO(&writeset);
 
     int idxConnection = 0;
-    for(idxConnection=0; idxConnection < ctx->pInstance->httpdInstance.maxConnections; idxConnection++) {
+    for(idxConnection=ctx->connStart; idxConnection < ctx->connStart + ctx->connCount; idxConnection++) {
         RtosConnType *pRconn = &(ctx->pInstance->rconn[idxConnection]);
         if (pRconn->fd != -1) {
             FD_SET(pRconn->fd, &readset);
@@ -358,109 +2004,51 @@ void platHttpServerTaskProcess(ServerTaskContext *ctx) {
         if(ctx->listeningForNewConnections)
         {
             ctx->listeningForNewConnections = false;
-            ESP_LOGI(TAG, "all %d connections in use on '%s'", ctx->pInstance->httpdInstance.maxConnections, ctx->serverStr);
+            ESP_LOGI(TAG, "all %d connections in use on '%s'", ctx->connCount, ctx->serverStr);
         }
     }
 
-#ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
-    FD_SET(ctx->udpListenFd, &readset);
-    if(ctx->udpListenFd > maxfdp) maxfdp = ctx->udpListenFd;
+#ifdef HTTPD_WAKE_EVENTFD
+    FD_SET(ctx->wakeFd, &readset);
+    if(ctx->wakeFd > maxfdp) maxfdp = ctx->wakeFd;
 #endif
 
-    //polling all exist client handle,wait until readable/writable
-    
-    int32 retSelect = select(maxfdp+1, &readset, &writeset, NULL, ctx->selectTimeoutData);
-    ESP_LOGD(TAG, "select retSelect");
-    if(retSelect <= 0) { return; }
-#ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
-    if (FD_ISSET(ctx->udpListenFd, &readset)) {
-        ctx->shutdown = true;
-        ESP_LOGI(TAG, "shutting down");
-    }
-#endif
-
-    //See if we need to accept a new connection
-    if (FD_ISSET(ctx->listenFd, &readset)) {
-        int32 len = sizeof(struct sockaddr_in);
-        struct sockaddr_in remote_addr;
-        ctx->remoteFd = accept(ctx->listenFd, (struct sockaddr *)&remote_addr, (socklen_t *)&len);
-        if (ctx->remoteFd<0) {
-            ESP_LOGE(TAG, "accept failed");
-            perror("accept");
-            return;
-        }
-        
-        int highestConnection = 0;
-        for(highestConnection=0; highestConnection < ctx->pInstance->httpdInstance.maxConnections; highestConnection++) if (ctx->pInstance->rconn[highestConnection].fd==-1) break;
-        if (highestConnection == ctx->pInstance->httpdInstance.maxConnections) {
-            ESP_LOGE(TAG, "all connections in use, closing fd");
-            close(ctx->remoteFd);
-            return;
-        }
-
-        RtosConnType *pRconn = &(ctx->pInstance->rconn[highestConnection]);
-
-        int keepAlive = 1; //enable keepalive
-        int keepIdle = 60; //60s
-        int keepInterval = 5; //5s
-        int keepCount = 3; //retry times
-        int nodelay = 0;
-#ifdef CONFIG_ESPHTTPD_TCP_NODELAY
-        nodelay = 1;  // enable TCP_NODELAY to speed-up transfers of small files.  See Nagle's Algorithm.
+    // wake up for the next connection deadline if that is earlier than the configured timeout
+    struct timeval *pSelectTimeout = ctx->selectTimeoutData;
+    struct timeval deadlineTimeout;
+    int deadlineMs = httpdTimerWheelTimeoutMs(&ctx->timers, platTimeMs());
+#ifdef HTTPD_CMD_POLL_MS
+    // nothing wakes the task up for posted commands
+    if((deadlineMs < 0) || (deadlineMs > HTTPD_CMD_POLL_MS)) deadlineMs = HTTPD_CMD_POLL_MS;
 #endif
-        setsockopt(ctx->remoteFd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepAlive, sizeof(keepAlive));
-        setsockopt(ctx->remoteFd, IPPROTO_TCP, TCP_KEEPIDLE, (void*)&keepIdle, sizeof(keepIdle));
-        setsockopt(ctx->remoteFd, IPPROTO_TCP, TCP_KEEPINTVL, (void *)&keepInterval, sizeof(keepInterval));
-        setsockopt(ctx->remoteFd, IPPROTO_TCP, TCP_KEEPCNT, (void *)&keepCount, sizeof(keepCount));
-        setsockopt(ctx->remoteFd, IPPROTO_TCP, TCP_NODELAY, (void *)&nodelay, sizeof(nodelay));
-
-        pRconn->fd=ctx->remoteFd;
-        pRconn->needWriteDoneNotif=0;
-        pRconn->needsClose=0;
-
-#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-        if(ctx->pInstance->httpdFlags & HTTPD_FLAG_SSL)
-        {
-            ESP_LOGD(TAG, "SSL server create .....");
-            pRconn->ssl = SSL_new(ctx->pInstance->ctx);
-            if (!pRconn->ssl) {
-                ESP_LOGE(TAG, "SSL_new");
-                close(ctx->remoteFd);
-                pRconn->fd = -1;
-                return;
-            }
-            ESP_LOGD(TAG, "OK");
-
-            SSL_set_fd(pRconn->ssl, pRconn->fd);
+    if((deadlineMs >= 0) &&
+        (!pSelectTimeout || (deadlineMs < (pSelectTimeout->tv_sec * 1000) + (pSelectTimeout->tv_usec / 1000))))
+    {
+        deadlineTimeout.tv_sec = deadlineMs / 1000;
+        deadlineTimeout.tv_usec = (deadlineMs % 1000) * 1000;
+        pSelectTimeout = &deadlineTimeout;
+    }
 
-            ESP_LOGD(TAG, "SSL server accept client .....");
-            int32 retAcceptSSL = SSL_accept(pRconn->ssl);
-            if (!retAcceptSSL) {
-                int ssl_error = SSL_get_error(pRconn->ssl, retAcceptSSL);
-                ESP_LOGE(TAG, "SSL_accept %d", ssl_error);
-                close(ctx->remoteFd);
-                SSL_free(pRconn->ssl);
-                pRconn->fd = -1;
-                return;
-            }
-            ESP_LOGD(TAG, "OK");
-        }
+    //polling all exist client handle,wait until readable/writable
+    
+    int32 retSelect = select(maxfdp+1, &readset, &writeset, NULL, pSelectTimeout);
+    ESP_LOGD(TAG, "select retSelect");
+    if(retSelect <= 0) {
+#ifdef HTTPD_CMD_POLL_MS
+        if(__atomic_load_n(&ctx->cmdQueue, __ATOMIC_RELAXED) != NULL) platHandleCommands(ctx);
 #endif
-        struct sockaddr name;
-        len=sizeof(name);
-        getpeername(ctx->remoteFd, &name, (socklen_t *)&len);
-        struct sockaddr_in *piname=(struct sockaddr_in *)&name;
-
-        pRconn->port = piname->sin_port;
-        memcpy(&pRconn->ip, &piname->sin_addr.s_addr, sizeof(pRconn->ip));
+        httpdTimerWheelAdvance(&ctx->timers, platTimeMs());
+        return;
+    }
 
-        // NOTE: httpdConnectCb cannot fail
-        httpdConnectCb(&ctx->pInstance->httpdInstance, &pRconn->connData);
+    //See if we need to accept new connections
+    if (FD_ISSET(ctx->listenFd, &readset)) {
+        platAcceptConnections(ctx);
     }
 
     //See if anything happened on the existing connections.
     int idxCheckConnection = 0;
-    for(idxCheckConnection = 0; idxCheckConnection < ctx->pInstance->httpdInstance.maxConnections; idxCheckConnection++) {
+    for(idxCheckConnection = ctx->connStart; idxCheckConnection < ctx->connStart + ctx->connCount; idxCheckConnection++) {
         RtosConnType *pRconn = &(ctx->pInstance->rconn[idxCheckConnection]);
 
         //Skip empty slots
@@ -468,92 +2056,49 @@ void platHttpServerTaskProcess(ServerTaskContext *ctx) {
 
         //Check for write availability first: the read routines may write needWriteDoneNotif while
         //the select didn't check for that.
-        if (pRconn->needWriteDoneNotif && FD_ISSET(pRconn->fd, &writeset)) {
-            pRconn->needWriteDoneNotif=0; //Do this first, httpdSentCb may write something making this 1 again.
-            if (pRconn->needsClose) {
-                //Do callback and close fd.
-                closeConnection(ctx->pInstance, pRconn);
-            } 
-            else {
-                if(httpdSentCb(&ctx->pInstance->httpdInstance, &pRconn->connData) != CallbackSuccess) {
-                    closeConnection(ctx->pInstance, pRconn);
-                }
-            }
+        bool writable = pRconn->needWriteDoneNotif && FD_ISSET(pRconn->fd, &writeset);
+        if (writable) {
+            platHandleConnWritable(ctx, pRconn);
         }
 
-        if (FD_ISSET(pRconn->fd, &readset)) {
-#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-            if(ctx->pInstance->httpdFlags & HTTPD_FLAG_SSL)
-            {
-                int bytesStillAvailable;
-
-                // NOTE: we repeat the call to SSL_read() and process data
-                // while SSL indicates there is still pending data.
-                //
-                // select() isn't detecting available data, this
-                // re-read approach resolves an issue where data is stuck in
-                // SSL internal buffers
-                do {
-                    int32 retReadSSL = SSL_read(pRconn->ssl, &ctx->pInstance->precvbuf, RECV_BUF_SIZE - 1);
-
-                    bytesStillAvailable = SSL_has_pending(pRconn->ssl);
-
-                    if(retReadSSL <= 0)
-                    {
-                        int ssl_error = SSL_get_error(pRconn->ssl, retReadSSL);
-                        if(ssl_error != SSL_ERROR_NONE)
-                        {
-                            ESP_LOGE(TAG, "ssl_error %d, retReadSSL %d, bytesStillAvailable %d", ssl_error, retReadSSL, bytesStillAvailable);
-                        } else
-                        {
-                            ESP_LOGD(TAG, "ssl_error %d, retReadSSL %d, bytesStillAvailable %d", ssl_error, retReadSSL, bytesStillAvailable);
-                        }
-                    }
-
-                    if (retReadSSL > 0) {
-                        //Data received. Pass to httpd.
-                        if(httpdRecvCb(&ctx->pInstance->httpdInstance, &pRconn->connData, &ctx->pInstance->precvbuf[0], retReadSSL) != CallbackSuccess)
-                        {
-                            closeConnection(ctx->pInstance, pRconn);
-                        }
-                    } else {
-                        //recv error,connection close
-                        closeConnection(ctx->pInstance, pRconn);
-                    }
-                } while(bytesStillAvailable);
-            } else
-            {
-#endif
-                int32 retRecv = recv(pRconn->fd, &ctx->pInstance->precvbuf[0], RECV_BUF_SIZE, 0);
+        bool readable = (pRconn->fd != -1) && FD_ISSET(pRconn->fd, &readset);
+        if (readable) {
+            platHandleConnReadable(ctx, pRconn);
+        }
 
-                if (retRecv > 0) {
-                    //Data received. Pass to httpd.
-                    if(httpdRecvCb(&ctx->pInstance->httpdInstance, &pRconn->connData, &ctx->pInstance->precvbuf[0], retRecv) != CallbackSuccess)
-                    {
-                        closeConnection(ctx->pInstance, pRconn);
-                    }
-                } else {
-                    //recv error,connection close
-                    closeConnection(ctx->pInstance, pRconn);
-                }
-#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
-            }
-#endif
+        if (readable || writable) {
+            platUpdateConnTimeout(ctx, pRconn, readable, writable);
         }
     }
+
+#ifdef HTTPD_WAKE_EVENTFD
+    if (FD_ISSET(ctx->wakeFd, &readset)) {
+        platHandleCommands(ctx);
+    }
+#else
+    if (__atomic_load_n(&ctx->cmdQueue, __ATOMIC_RELAXED) != NULL) {
+        platHandleCommands(ctx);
+    }
+#endif
+
+    httpdTimerWheelAdvance(&ctx->timers, platTimeMs());
 }
 
+#endif /* HTTPD_USE_EPOLL, HTTPD_USE_IO_URING */
+
 /**
  * Manually deinit all data required for processing the server task
  */
 PLAT_RETURN platHttpServerTaskDeinit(ServerTaskContext *ctx) {
 #ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
     close(ctx->listenFd);
-    close(ctx->udpListenFd);
+    if(ctx->wakeFd >= 0) close(ctx->wakeFd);
+    // commands posted after the task exited don't wake anything up
+    ctx->wakeFd = -1;
 
     // close all open connections
     int idxConnection = 0;
-    for(idxConnection=0; idxConnection < ctx->pInstance->httpdInstance.maxConnections; idxConnection++)
+    for(idxConnection=ctx->connStart; idxConnection < ctx->connStart + ctx->connCount; idxConnection++)
     {
         RtosConnType *pRconn = &(ctx->pInstance->rconn[idxConnection]);
 
@@ -563,8 +2108,51 @@ PLAT_RETURN platHttpServerTaskDeinit(ServerTaskContext *ctx) {
         }
     }
 
+#ifdef HTTPD_USE_EPOLL
+    close(ctx->timerFd);
+    close(ctx->epollFd);
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+    // closing the ring cancels the requests of the closed connections
+    httpdUringDeinit(&ctx->ring);
+    for(idxConnection=ctx->connStart; idxConnection < ctx->connStart + ctx->connCount; idxConnection++)
+    {
+        RtosConnType *pRconn = &(ctx->pInstance->rconn[idxConnection]);
+        free(pRconn->uringSendBuf);
+        pRconn->uringSendBuf = NULL;
+        pRconn->uringArmed = 0;
+    }
+#endif
+
+    free(ctx->precvbuf);
+    ctx->precvbuf = NULL;
+
     ESP_LOGI(TAG, "httpd on %s exiting", ctx->serverStr);
-    ctx->pInstance->isShutdown = true;
+
+    // the instance is shut down once its last server task exits. httpdPlatShutdown() frees ctx
+    // and may tear down the instance as soon as that is signalled, so it is signalled last.
+    HttpdFreertosInstance *pInstance = ctx->pInstance;
+    httpdPlatLock(&pInstance->httpdInstance);
+    pInstance->runningWorkers--;
+    bool lastWorker = (pInstance->runningWorkers == 0);
+#ifndef linux
+    xTaskHandle shutdownWaiter = pInstance->shutdownWaiter;
+#endif
+    httpdPlatUnlock(&pInstance->httpdInstance);
+
+    if(lastWorker)
+    {
+#ifdef linux
+        __atomic_store_n(&pInstance->isShutdown, true, __ATOMIC_RELEASE);
+#else
+        pInstance->isShutdown = true;
+        if(shutdownWaiter)
+        {
+            xTaskNotifyGive(shutdownWaiter);
+        }
+#endif
+    }
 #endif /* #ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT */
 
     PLAT_TASK_EXIT;
@@ -573,84 +2161,131 @@ PLAT_RETURN platHttpServerTaskDeinit(ServerTaskContext *ctx) {
 
 #ifdef linux
 
-#include <signal.h>
-#include <time.h>
+/*
+ * The platform timers share a timer wheel that is run by a single thread, waiting on a
+ * timerfd armed to the next deadline. The callbacks are called from that thread with
+ * platTimerMux held, they may start, stop or delete timers.
+ */
+static pthread_once_t platTimerOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t platTimerMux;
+static HttpdTimerWheel platTimerWheel;
+static int platTimerFd = -1;
+
+// NOTE: must be called with platTimerMux held
+static void platTimerUpdateFd(void)
+{
+    uint64_t now = platTimeMs();
+    int timeoutMs = httpdTimerWheelTimeoutMs(&platTimerWheel, now);
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if(timeoutMs >= 0)
+    {
+        uint64_t deadline = now + timeoutMs;
+        its.it_value.tv_sec = deadline / 1000;
+        its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    if(timerfd_settime(platTimerFd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+    {
+        ESP_LOGE(TAG, "timerfd_settime errno %d", errno);
+    }
+}
 
-void platform_timer_handler (union sigval val)
+static void *platTimerTask(void *arg)
 {
-    HttpdPlatTimerHandle handle = val.sival_ptr;
+    uint64_t expirations;
+    while(1)
+    {
+        if((read(platTimerFd, &expirations, sizeof(expirations)) < 0) && (errno != EINTR))
+        {
+            ESP_LOGE(TAG, "timerfd read errno %d", errno);
+            break;
+        }
 
-    // call the callback
-    handle->callback(handle->callbackArg);
+        pthread_mutex_lock(&platTimerMux);
+        httpdTimerWheelAdvance(&platTimerWheel, platTimeMs());
+        platTimerUpdateFd();
+        pthread_mutex_unlock(&platTimerMux);
+    }
+    return NULL;
+}
 
-    // stop the timer if we aren't autoreloading
-    if(!handle->autoReload)
+static void platTimerInit(void)
+{
+    pthread_mutexattr_t mutexattr;
+    pthread_mutexattr_init(&mutexattr);
+    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&platTimerMux, &mutexattr);
+    pthread_mutexattr_destroy(&mutexattr);
+
+    httpdTimerWheelInit(&platTimerWheel, platTimeMs());
+
+    platTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(platTimerFd < 0)
+    {
+        ESP_LOGE(TAG, "timerfd_create errno %d", errno);
+        return;
+    }
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, platTimerTask, NULL) != 0)
+    {
+        ESP_LOGE(TAG, "pthread_create platTimerTask");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void platTimerExpired(HttpdTimer *timer, void *arg)
+{
+    HttpdPlatTimerHandle handle = arg;
+
+    // re-arm before the callback so it can stop the timer again
+    if(handle->autoReload)
     {
-        httpdPlatTimerStop(handle);
+        httpdTimerArm(&platTimerWheel, &handle->entry, platTimeMs(), handle->timerPeriodMS);
     }
+
+    handle->callback(handle->callbackArg);
 }
 
 HttpdPlatTimerHandle httpdPlatTimerCreate(const char *name, int periodMs, int autoreload, void (*callback)(void *arg), void *ctx)
 {
-    struct sigevent event;
+    pthread_once(&platTimerOnce, platTimerInit);
+
     HttpdPlatTimerHandle handle = (HttpdPlatTimerHandle)malloc(sizeof(HttpdPlatTimer));
+    if(!handle)
+    {
+        ESP_LOGE(TAG, "malloc timer %s", name);
+        return NULL;
+    }
 
     handle->autoReload = autoreload;
     handle->callback = callback;
     handle->timerPeriodMS = periodMs;
     handle->callbackArg = ctx;
-
-    event.sigev_notify = SIGEV_THREAD;
-    event.sigev_notify_function = platform_timer_handler;
-    event.sigev_value.sival_ptr = handle;
-
-    int retval = timer_create(CLOCK_MONOTONIC, &event, &(handle->timer));
-    if(retval != 0)
-    {
-        ESP_LOGE(TAG, "timer_create() %d", retval);
-    }
+    httpdTimerInit(&handle->entry, platTimerExpired, handle);
 
     return handle;
 }
 
 void httpdPlatTimerStart(HttpdPlatTimerHandle handle)
 {
-    struct itimerspec new_value;
-    struct itimerspec old_value;
-    int seconds = handle->timerPeriodMS / 1000;
-    int nsec = ((handle->timerPeriodMS % 1000) * 1000000);
-    new_value.it_value.tv_sec = seconds;
-    new_value.it_value.tv_nsec = nsec;
-    new_value.it_interval.tv_sec = seconds;
-    new_value.it_interval.tv_nsec = nsec;
-    int retval = timer_settime(handle->timer, 0,
-        &new_value,
-        &old_value);
-
-    if(retval != 0)
-    {
-        ESP_LOGE(TAG, "timer_settime() %d", retval);
-    }
+    pthread_mutex_lock(&platTimerMux);
+    httpdTimerArm(&platTimerWheel, &handle->entry, platTimeMs(), handle->timerPeriodMS);
+    platTimerUpdateFd();
+    pthread_mutex_unlock(&platTimerMux);
 }
 
 void httpdPlatTimerStop(HttpdPlatTimerHandle handle)
 {
-    struct itimerspec new_value;
-    struct itimerspec old_value;
-    memset(&new_value, 0, sizeof(struct itimerspec));
-    int retval = timer_settime(handle->timer, 0,
-        &new_value,
-        &old_value);
-
-    if(retval != 0)
-    {
-        ESP_LOGE(TAG, "timer_settime() %d", retval);
-    }
+    pthread_mutex_lock(&platTimerMux);
+    httpdTimerDisarm(&platTimerWheel, &handle->entry);
+    pthread_mutex_unlock(&platTimerMux);
 }
 
 void httpdPlatTimerDelete(HttpdPlatTimerHandle handle)
 {
-    timer_delete(handle->timer);
+    httpdPlatTimerStop(handle);
     free(handle);
 }
 #else
@@ -691,14 +2326,67 @@ HttpdInitStatus ICACHE_FLASH_ATTR httpdFreertosInitEx(HttpdFreertosInstance *pIn
 
     pInstance->httpdInstance.builtInUrls=fixedUrls;
     pInstance->httpdInstance.maxConnections = maxConnections;
+    pInstance->httpdInstance.maxBodyLen = CONFIG_ESPHTTPD_MAX_BODY_LEN;
 
     status = InitializationSuccess;
     pInstance->httpPort = port;
     pInstance->httpListenAddress.sin_addr.s_addr = listenAddress;
     pInstance->httpdFlags = flags;
     pInstance->isShutdown = false;
+    pInstance->workerCount = 1;
+    pInstance->runningWorkers = 0;
+#ifndef linux
+    pInstance->shutdownWaiter = NULL;
+#endif
+    pInstance->workers = NULL;
+    pInstance->workersAllocated = false;
+    pInstance->listenBacklog = CONFIG_ESPHTTPD_LISTEN_BACKLOG;
+    pInstance->deferAcceptS = 0;
+    pInstance->fastOpenQueueLen = 0;
+
+    pInstance->timeoutMs[HTTPD_TIMEOUT_NONE] = 0;
+    pInstance->timeoutMs[HTTPD_TIMEOUT_HANDSHAKE] = CONFIG_ESPHTTPD_HANDSHAKE_TIMEOUT_MS;
+    pInstance->timeoutMs[HTTPD_TIMEOUT_HEADER] = CONFIG_ESPHTTPD_HEADER_TIMEOUT_MS;
+    pInstance->timeoutMs[HTTPD_TIMEOUT_BODY] = CONFIG_ESPHTTPD_BODY_TIMEOUT_MS;
+    pInstance->timeoutMs[HTTPD_TIMEOUT_KEEPALIVE] = CONFIG_ESPHTTPD_KEEPALIVE_TIMEOUT_MS;
+    pInstance->timeoutMs[HTTPD_TIMEOUT_WRITE] = CONFIG_ESPHTTPD_WRITE_TIMEOUT_MS;
 
     pInstance->rconn = connectionBuffer;
+    for(int i = 0; i < maxConnections; i++)
+    {
+        pInstance->rconn[i].resumeCmd.type = HTTPD_PLAT_CMD_RESUME;
+        pInstance->rconn[i].resumeQueued = 0;
+        pInstance->rconn[i].generation = 0;
+#ifdef HTTPD_USE_IO_URING
+        pInstance->rconn[i].eventsCmd.type = HTTPD_PLAT_CMD_UPDATE_EVENTS;
+        pInstance->rconn[i].eventsQueued = 0;
+        pInstance->rconn[i].uringArmed = 0;
+        pInstance->rconn[i].uringSendBuf = NULL;
+        pInstance->rconn[i].uringSendLen = 0;
+#endif
+    }
+    pInstance->httpdInstance.websockets = NULL;
+    memset(&pInstance->httpdInstance.headPool, 0, sizeof(HttpdBuffPool));
+    memset(&pInstance->httpdInstance.sendBuffPool, 0, sizeof(HttpdBuffPool));
+    memset(&pInstance->httpdInstance.arenaPool, 0, sizeof(HttpdBuffPool));
+
+#ifdef linux
+    pthread_mutexattr_t mutexattr;
+    pthread_mutexattr_init(&mutexattr);
+    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&pInstance->httpdMux, &mutexattr);
+    for(int i = 0; i < maxConnections; i++)
+    {
+        pthread_mutex_init(&pInstance->rconn[i].connMux, &mutexattr);
+    }
+    pthread_mutexattr_destroy(&mutexattr);
+#else
+    pInstance->httpdMux = xSemaphoreCreateRecursiveMutex();
+    for(int i = 0; i < maxConnections; i++)
+    {
+        pInstance->rconn[i].connMux = xSemaphoreCreateRecursiveMutex();
+    }
+#endif
 
     ESP_LOGI(TAG, "address %s, port %d, maxConnections %d, mode %s",
             serverStr,
@@ -734,6 +2422,22 @@ SslInitStatus ICACHE_FLASH_ATTR httpdFreertosSslInit(HttpdFreertosInstance *pIns
         {
             ESP_LOGE(TAG, "create ssl context");
             status = StartFailedSslNotConfigured;
+        } else
+        {
+            pInstance->sslFullHandshakes = 0;
+            pInstance->sslResumedHandshakes = 0;
+            memset(pInstance->ticketKeys, 0, sizeof(pInstance->ticketKeys));
+#ifdef HTTPD_SSL_SESSION_RESUMPTION
+            SSL_CTX_set_app_data(pInstance->ctx, pInstance);
+            // sessions are only resumed within the same context, required once client
+            // certificates are verified
+            static const unsigned char sessionIdContext[] = "esphttpd";
+            SSL_CTX_set_session_id_context(pInstance->ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+            httpdFreertosSslSetSessionCache(pInstance, CONFIG_ESPHTTPD_SSL_SESSION_CACHE_SIZE,
+                                            CONFIG_ESPHTTPD_SSL_SESSION_TIMEOUT_S);
+            httpdFreertosSslSetSessionTickets(pInstance, CONFIG_ESPHTTPD_SSL_TICKET_KEY_LIFETIME_S > 0,
+                                            CONFIG_ESPHTTPD_SSL_TICKET_KEY_LIFETIME_S);
+#endif
         }
     }
 #endif
@@ -811,6 +2515,194 @@ void ICACHE_FLASH_ATTR httpdFreertosSslAddClientCertificate(HttpdFreertosInstanc
 #endif
 }
 
+void ICACHE_FLASH_ATTR httpdFreertosSslSetSessionCache(HttpdFreertosInstance *pInstance, int cacheSize, int timeoutS)
+{
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if(!(pInstance->httpdFlags & HTTPD_FLAG_SSL))
+    {
+        ESP_LOGE(TAG, "Server not initialized for ssl");
+        return;
+    }
+    if(!pInstance->ctx)
+    {
+        ESP_LOGE(TAG, "Call httpdFreertosSslInit() first");
+        return;
+    }
+#ifdef HTTPD_SSL_SESSION_RESUMPTION
+    if(cacheSize > 0)
+    {
+        SSL_CTX_set_session_cache_mode(pInstance->ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(pInstance->ctx, cacheSize);
+    } else
+    {
+        SSL_CTX_set_session_cache_mode(pInstance->ctx, SSL_SESS_CACHE_OFF);
+    }
+    if(timeoutS > 0)
+    {
+        SSL_CTX_set_timeout(pInstance->ctx, timeoutS);
+    }
+#else
+    ESP_LOGW(TAG, "session cache not supported on this platform");
+#endif
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSslSetSessionTickets(HttpdFreertosInstance *pInstance, bool enable, int keyLifetimeS)
+{
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if(!(pInstance->httpdFlags & HTTPD_FLAG_SSL))
+    {
+        ESP_LOGE(TAG, "Server not initialized for ssl");
+        return;
+    }
+    if(!pInstance->ctx)
+    {
+        ESP_LOGE(TAG, "Call httpdFreertosSslInit() first");
+        return;
+    }
+#ifdef HTTPD_SSL_SESSION_RESUMPTION
+    if(enable && (keyLifetimeS > 0))
+    {
+        httpdPlatLock(&pInstance->httpdInstance);
+        pInstance->ticketKeyLifetimeS = keyLifetimeS;
+        httpdPlatUnlock(&pInstance->httpdInstance);
+
+        SSL_CTX_clear_options(pInstance->ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(pInstance->ctx, sslTicketKeyCb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(pInstance->ctx, sslTicketKeyCb);
+#endif
+    } else
+    {
+        SSL_CTX_set_options(pInstance->ctx, SSL_OP_NO_TICKET);
+    }
+#else
+    ESP_LOGW(TAG, "session tickets not supported on this platform");
+#endif
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSslSetKernelTls(HttpdFreertosInstance *pInstance, bool enable)
+{
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    if(!(pInstance->httpdFlags & HTTPD_FLAG_SSL))
+    {
+        ESP_LOGE(TAG, "Server not initialized for ssl");
+        return;
+    }
+    if(!pInstance->ctx)
+    {
+        ESP_LOGE(TAG, "Call httpdFreertosSslInit() first");
+        return;
+    }
+#ifdef HTTPD_SSL_KTLS
+    if(enable)
+    {
+        SSL_CTX_set_options(pInstance->ctx, SSL_OP_ENABLE_KTLS);
+    } else
+    {
+        SSL_CTX_clear_options(pInstance->ctx, SSL_OP_ENABLE_KTLS);
+    }
+#else
+    if(enable)
+    {
+        ESP_LOGW(TAG, "kernel tls not supported on this platform");
+    }
+#endif
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSslGetStats(HttpdFreertosInstance *pInstance, HttpdSslStats *pStats)
+{
+    memset(pStats, 0, sizeof(*pStats));
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+    pStats->fullHandshakes = __atomic_load_n(&pInstance->sslFullHandshakes, __ATOMIC_RELAXED);
+    pStats->resumedHandshakes = __atomic_load_n(&pInstance->sslResumedHandshakes, __ATOMIC_RELAXED);
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetWorkerCount(HttpdFreertosInstance *pInstance, int workerCount)
+{
+#ifdef linux
+    if(workerCount < 1)
+    {
+        workerCount = 1;
+    } else if(workerCount > pInstance->httpdInstance.maxConnections)
+    {
+        ESP_LOGW(TAG, "limiting %d workers to maxConnections %d", workerCount, pInstance->httpdInstance.maxConnections);
+        workerCount = pInstance->httpdInstance.maxConnections;
+    }
+#else
+    if(workerCount != 1)
+    {
+        ESP_LOGW(TAG, "multiple workers not supported on this platform");
+        workerCount = 1;
+    }
+#endif
+
+    pInstance->workerCount = workerCount;
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetMaxBodyLen(HttpdFreertosInstance *pInstance, int len)
+{
+    pInstance->httpdInstance.maxBodyLen = (len > 0) ? len : 0;
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetListenBacklog(HttpdFreertosInstance *pInstance, int backlog)
+{
+    pInstance->listenBacklog = (backlog > 0) ? backlog : 0;
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetDeferAccept(HttpdFreertosInstance *pInstance, int timeoutS)
+{
+#ifdef linux
+    pInstance->deferAcceptS = (timeoutS > 0) ? timeoutS : 0;
+#else
+    if(timeoutS > 0)
+    {
+        ESP_LOGW(TAG, "TCP_DEFER_ACCEPT not supported on this platform");
+    }
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetFastOpen(HttpdFreertosInstance *pInstance, int queueLen)
+{
+#ifdef linux
+    pInstance->fastOpenQueueLen = (queueLen > 0) ? queueLen : 0;
+#else
+    if(queueLen > 0)
+    {
+        ESP_LOGW(TAG, "TCP_FASTOPEN not supported on this platform");
+    }
+#endif
+}
+
+void ICACHE_FLASH_ATTR httpdFreertosSetTimeout(HttpdFreertosInstance *pInstance, HttpdTimeoutKind kind, int timeoutMs)
+{
+    if((kind <= HTTPD_TIMEOUT_NONE) || (kind >= HTTPD_TIMEOUT_KIND_COUNT)) return;
+    pInstance->timeoutMs[kind] = (timeoutMs > 0) ? timeoutMs : 0;
+}
+
+#ifdef HTTPD_USE_IO_URING
+/**
+ * Check that the kernel provides what the io_uring server loop needs
+ *
+ * io_uring may be missing, too old, or disabled by kernel.io_uring_disabled or seccomp.
+ */
+static bool platUringSupported(void)
+{
+    HttpdUring ring;
+    bool supported = httpdUringInit(&ring, 2) && httpdUringSetupBuffers(&ring, PLAT_URING_BUF_GROUP, 1, 64);
+    if(!supported)
+    {
+        ESP_LOGE(TAG, "io_uring not supported, errno %d", errno);
+    }
+    httpdUringDeinit(&ring);
+    return supported;
+}
+#endif
+
 HttpdStartStatus ICACHE_FLASH_ATTR httpdFreertosStart(HttpdFreertosInstance *pInstance)
 {
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
@@ -821,9 +2713,42 @@ HttpdStartStatus ICACHE_FLASH_ATTR httpdFreertosStart(HttpdFreertosInstance *pIn
     }
 #endif
 
+#ifdef HTTPD_USE_IO_URING
+    if(!platUringSupported())
+    {
+        return StartFailedIoUringNotSupported;
+    }
+#endif
+
+    pInstance->workers = (ServerTaskContext*)calloc(pInstance->workerCount, sizeof(ServerTaskContext));
+    if(!pInstance->workers)
+    {
+        ESP_LOGE(TAG, "calloc workers");
+        return StartFailedOutOfMemory;
+    }
+    pInstance->workersAllocated = true;
+
+    // split the connection buffer into equal slices, the first workers take the remainder
+    int connPerWorker = pInstance->httpdInstance.maxConnections / pInstance->workerCount;
+    int connRemainder = pInstance->httpdInstance.maxConnections % pInstance->workerCount;
+    int connStart = 0;
+    for(int i = 0; i < pInstance->workerCount; i++)
+    {
+        ServerTaskContext *ctx = &pInstance->workers[i];
+        ctx->pInstance = pInstance;
+        ctx->connStart = connStart;
+        ctx->connCount = connPerWorker + ((i < connRemainder) ? 1 : 0);
+        connStart += ctx->connCount;
+        platCommandQueueInit(ctx);
+    }
+
+    pInstance->runningWorkers = pInstance->workerCount;
+
 #ifdef linux
-    pthread_t thread;
-    pthread_create(&thread, NULL, platHttpServerTask, pInstance);
+    for(int i = 0; i < pInstance->workerCount; i++)
+    {
+        pthread_create(&pInstance->workers[i].thread, NULL, platHttpServerWorkerTask, &pInstance->workers[i]);
+    }
 #else
 #ifdef ESP32
 #ifndef CONFIG_ESPHTTPD_PROC_CORE
@@ -832,14 +2757,14 @@ HttpdStartStatus ICACHE_FLASH_ATTR httpdFreertosStart(HttpdFreertosInstance *pIn
 #ifndef CONFIG_ESPHTTPD_PROC_PRI
 #define CONFIG_ESPHTTPD_PROC_PRI    4
 #endif
-    xTaskCreatePinnedToCore(platHttpServerTask, (const char *)"esphttpd", HTTPD_STACKSIZE, pInstance, CONFIG_ESPHTTPD_PROC_PRI, NULL, CONFIG_ESPHTTPD_PROC_CORE);
+    xTaskCreatePinnedToCore(platHttpServerWorkerTask, (const char *)"esphttpd", HTTPD_STACKSIZE, &pInstance->workers[0], CONFIG_ESPHTTPD_PROC_PRI, NULL, CONFIG_ESPHTTPD_PROC_CORE);
 #else
-    xTaskCreate(platHttpServerTask, (const signed char *)"esphttpd", HTTPD_STACKSIZE, pInstance, 4, NULL);
+    xTaskCreate(platHttpServerWorkerTask, (const signed char *)"esphttpd", HTTPD_STACKSIZE, &pInstance->workers[0], 4, NULL);
 #endif
 #endif
 
-    ESP_LOGI(TAG, "starting server on port port %d, maxConnections %d, mode %s",
-            pInstance->httpPort, pInstance->httpdInstance.maxConnections,
+    ESP_LOGI(TAG, "starting server on port port %d, maxConnections %d, workers %d, mode %s",
+            pInstance->httpPort, pInstance->httpdInstance.maxConnections, pInstance->workerCount,
             (pInstance->httpdFlags & HTTPD_FLAG_SSL) ? "ssl" : "non-ssl");
 
     return StartSuccess;
@@ -848,41 +2773,61 @@ HttpdStartStatus ICACHE_FLASH_ATTR httpdFreertosStart(HttpdFreertosInstance *pIn
 #ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
 void httpdPlatShutdown(HttpdInstance *pInstance)
 {
-    int err;
     HttpdFreertosInstance *pFR = fr_of_instance(pInstance);
 
-    int s = socket(AF_INET, SOCK_DGRAM, 0);
-    if(s <= 0)
-    {
-        ESP_LOGE(TAG, "socket %d", s);
-    }
-
-    struct sockaddr_in udp_addr;
-    memset(&udp_addr, 0, sizeof(udp_addr)); /* Zero out structure */
-    udp_addr.sin_family = AF_INET;			/* Internet address family */
-    udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    httpdPlatLock(pInstance);
+    bool running = (pFR->runningWorkers > 0);
 #ifndef linux
-    udp_addr.sin_len = sizeof(udp_addr);
+    pFR->shutdownWaiter = running ? xTaskGetCurrentTaskHandle() : NULL;
 #endif
-    udp_addr.sin_port = htons(pFR->udpShutdownPort);
+    httpdPlatUnlock(pInstance);
 
-    while(!pFR->isShutdown)
+    // the command stays queued until the server task gets to it, even if it hasn't entered
+    // its loop yet
+    if(running)
     {
-        ESP_LOGI(TAG, "sending shutdown to port %d", pFR->udpShutdownPort);
-
-        err = sendto(s, pFR, sizeof(pFR), 0,
-                (struct sockaddr*)&udp_addr, sizeof(udp_addr));
-        if(err != sizeof(pFR))
+        for(int i = 0; i < pFR->workerCount; i++)
         {
-            ESP_LOGE(TAG, "sendto");
-            perror("sendto");
+            platPostCommand(&pFR->workers[i], &pFR->workers[i].shutdownCmd);
         }
+    }
 
-        if(!pFR->isShutdown)
+#ifdef linux
+    if(pFR->workersAllocated)
+    {
+        for(int i = 0; i < pFR->workerCount; i++)
         {
-            vTaskDelay(200 / portTICK_PERIOD_MS);
+            pthread_join(pFR->workers[i].thread, NULL);
         }
     }
+    // a server task run by the application sets the flag as the last thing it does
+    while(!__atomic_load_n(&pFR->isShutdown, __ATOMIC_ACQUIRE))
+    {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+#else
+    if(running)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    pFR->shutdownWaiter = NULL;
+#endif
+
+    if(pFR->workersAllocated)
+    {
+        free(pFR->workers);
+        pFR->workersAllocated = false;
+    }
+    pFR->workers = NULL;
+
+    for(int i = 0; i < pFR->httpdInstance.maxConnections; i++)
+    {
+#ifdef linux
+        pthread_mutex_destroy(&pFR->rconn[i].connMux);
+#else
+        vSemaphoreDelete(pFR->rconn[i].connMux);
+#endif
+    }
 
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
     if(pFR->httpdFlags & HTTPD_FLAG_SSL)
@@ -890,8 +2835,6 @@ void httpdPlatShutdown(HttpdInstance *pInstance)
         SSL_CTX_free(pFR->ctx);
     }
 #endif
-
-    close(s);
 }
 #endif
 
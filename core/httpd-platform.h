@@ -1,19 +1,68 @@
 #ifndef HTTPD_PLATFORM_H
 #define HTTPD_PLATFORM_H
 
+#include <sys/uio.h>
 #include "libesphttpd/platform.h"
 
 /**
- * @return number of bytes that were written
+ * Write to a non-blocking connection
+ *
+ * @return number of bytes that were written, 0 if the socket can't take any data right now,
+ *         < 0 if the connection failed
  */
 int httpdPlatSendData(HttpdInstance *pInstance, HttpdConnData *pConn, char *buff, int len);
 
+/**
+ * Write the buffers of iov, in order, to a non-blocking connection
+ *
+ * @return same as httpdPlatSendData()
+ */
+int httpdPlatSendDataV(HttpdInstance *pInstance, HttpdConnData *pConn, const struct iovec *iov, int iovcnt);
+
+/**
+ * Whether httpdPlatSendFile() can be used for this connection
+ */
+bool httpdPlatCanSendFile(HttpdInstance *pInstance, HttpdConnData *pConn);
+
+/**
+ * Write up to len bytes of the file fd, starting at *offset, to a non-blocking connection
+ * without copying them through a buffer. *offset is advanced by the number of bytes written.
+ *
+ * @return number of bytes that were written, 0 if the socket can't take any data right now,
+ *         < 0 if the connection failed
+ */
+int httpdPlatSendFile(HttpdInstance *pInstance, HttpdConnData *pConn, int fd, off_t *offset, size_t len);
+
 void httpdPlatDisconnect(HttpdConnData *ponn);
 void httpdPlatDisableTimeout(HttpdConnData *pConn);
 
+/**
+ * Instance lock, only held for short critical sections on instance wide state
+ */
 void httpdPlatLock(HttpdInstance *pInstance);
 void httpdPlatUnlock(HttpdInstance *pInstance);
 
+/**
+ * Recursive lock of the state of a single connection
+ *
+ * NOTE: When both are needed the connection lock must be taken before the instance lock
+ */
+void httpdPlatConnLock(HttpdConnData *pConn);
+void httpdPlatConnUnlock(HttpdConnData *pConn);
+
+/**
+ * Take the connection lock only if that doesn't have to wait
+ *
+ * @return true if the lock was taken, release it with httpdPlatConnUnlock()
+ */
+bool httpdPlatConnTryLock(HttpdConnData *pConn);
+
+/**
+ * Have the server task that owns the connection call httpdContinue() on it, may be called
+ * from any thread
+ */
+void httpdPlatContinueAsync(HttpdInstance *pInstance, HttpdConnData *pConn);
+
 HttpdPlatTimerHandle httpdPlatTimerCreate(const char *name, int periodMs, int autoreload, void (*callback)(void *arg), void *ctx);
 void httpdPlatTimerStart(HttpdPlatTimerHandle timer);
 void httpdPlatTimerStop(HttpdPlatTimerHandle timer);
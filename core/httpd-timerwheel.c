@@ -0,0 +1,152 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+Hierarchical timer wheel, used for the connection timeouts of the server tasks and the
+platform timers.
+
+Level 0 has a slot per tick, every slot of level n spans all of level n-1. A timer is put in
+the lowest level that reaches its expiry time. Each time the index of level n wraps to 0 the
+next slot of level n+1 is emptied and its timers are re-inserted, now landing one level lower.
+*/
+
+#include <string.h>
+#include "libesphttpd/httpd-timerwheel.h"
+
+#define WHEEL_MASK (HTTPD_TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_MAX_DELTA ((uint32_t)1 << (HTTPD_TIMER_WHEEL_BITS * HTTPD_TIMER_WHEEL_LEVELS))
+
+static uint32_t msToTick(uint64_t ms) {
+    return (uint32_t)(ms / HTTPD_TIMER_WHEEL_TICK_MS);
+}
+
+static void wheelLink(HttpdTimerWheel *wheel, HttpdTimer *timer) {
+    uint32_t expires = timer->expires;
+    int32_t delta = (int32_t)(expires - wheel->tick);
+    HttpdTimer **slot;
+
+    if (delta < 0) {
+        //Already due, expires on the next tick that is processed
+        slot = &wheel->slots[0][wheel->tick & WHEEL_MASK];
+    } else {
+        int level;
+        if ((uint32_t)delta >= WHEEL_MAX_DELTA) {
+            //Beyond the reach of the wheel, park it as far out as possible. It is re-inserted
+            //from there and only expires once its real time has come.
+            delta = WHEEL_MAX_DELTA - 1;
+            expires = wheel->tick + delta;
+        }
+        for (level = 0; level < HTTPD_TIMER_WHEEL_LEVELS - 1; level++) {
+            if ((uint32_t)delta < ((uint32_t)1 << ((level + 1) * HTTPD_TIMER_WHEEL_BITS))) break;
+        }
+        slot = &wheel->slots[level][(expires >> (level * HTTPD_TIMER_WHEEL_BITS)) & WHEEL_MASK];
+    }
+
+    timer->next = *slot;
+    if (timer->next) timer->next->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void wheelUnlink(HttpdTimer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+//Re-insert the timers of a slot of an upper level, they move down by at least one level
+static void wheelCascade(HttpdTimerWheel *wheel, int level, uint32_t index) {
+    HttpdTimer *list = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (list) {
+        HttpdTimer *timer = list;
+        list = timer->next;
+        wheelLink(wheel, timer);
+    }
+}
+
+void httpdTimerWheelInit(HttpdTimerWheel *wheel, uint64_t nowMs) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick = msToTick(nowMs);
+}
+
+void httpdTimerInit(HttpdTimer *timer, HttpdTimerCb cb, void *arg) {
+    memset(timer, 0, sizeof(*timer));
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+void httpdTimerArm(HttpdTimerWheel *wheel, HttpdTimer *timer, uint64_t nowMs, uint32_t delayMs) {
+    httpdTimerDisarm(wheel, timer);
+    //Round up, a timer never expires early
+    timer->expires = msToTick(nowMs + delayMs + HTTPD_TIMER_WHEEL_TICK_MS - 1);
+    wheelLink(wheel, timer);
+    wheel->count++;
+}
+
+void httpdTimerDisarm(HttpdTimerWheel *wheel, HttpdTimer *timer) {
+    if (!httpdTimerIsArmed(timer)) return;
+    wheelUnlink(timer);
+    wheel->count--;
+}
+
+void httpdTimerWheelAdvance(HttpdTimerWheel *wheel, uint64_t nowMs) {
+    uint32_t now = msToTick(nowMs);
+
+    while ((int32_t)(now - wheel->tick) >= 0) {
+        uint32_t index = wheel->tick & WHEEL_MASK;
+        HttpdTimer *list;
+
+        if (wheel->count == 0) {
+            //Nothing to expire or cascade, catch up at once
+            wheel->tick = now + 1;
+            break;
+        }
+
+        if (index == 0) {
+            int level;
+            for (level = 1; level < HTTPD_TIMER_WHEEL_LEVELS; level++) {
+                uint32_t levelIndex = (wheel->tick >> (level * HTTPD_TIMER_WHEEL_BITS)) & WHEEL_MASK;
+                wheelCascade(wheel, level, levelIndex);
+                if (levelIndex != 0) break;
+            }
+        }
+        wheel->tick++;
+
+        //Move the expired timers to a local list, the callbacks may modify the wheel
+        list = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        if (list) list->pprev = &list;
+        while (list) {
+            HttpdTimer *timer = list;
+            wheelUnlink(timer);
+            if ((int32_t)(timer->expires - (wheel->tick - 1)) > 0) {
+                //A parked timer that isn't due yet
+                wheelLink(wheel, timer);
+                continue;
+            }
+            wheel->count--;
+            timer->cb(timer, timer->arg);
+        }
+    }
+}
+
+int httpdTimerWheelTimeoutMs(const HttpdTimerWheel *wheel, uint64_t nowMs) {
+    uint32_t due = wheel->tick;
+    int32_t ticks;
+    int i;
+
+    if (wheel->count == 0) return -1;
+
+    //The first occupied slot of level 0, or the next cascade, whichever comes first
+    for (i = 0; i < HTTPD_TIMER_WHEEL_SLOTS; i++) {
+        due = wheel->tick + i;
+        if ((due & WHEEL_MASK) == 0 || wheel->slots[0][due & WHEEL_MASK] != NULL) break;
+    }
+
+    ticks = (int32_t)(due - msToTick(nowMs));
+    if (ticks <= 0) return 0;
+    return ticks * HTTPD_TIMER_WHEEL_TICK_MS - (int)(nowMs % HTTPD_TIMER_WHEEL_TICK_MS);
+}
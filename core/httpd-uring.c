@@ -0,0 +1,241 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+io_uring plumbing of the io_uring server loop, see httpd-uring.h
+*/
+
+#ifdef linux
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "libesphttpd/httpd-uring.h"
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+bool httpdUringInit(HttpdUring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    // the ring is only used by the task that creates it, completions are processed while
+    // waiting for them. Older kernels don't know these flags.
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = uringSetup(entries, &p);
+    if(ring->fd < 0 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof(p));
+        ring->fd = uringSetup(entries, &p);
+    }
+    if(ring->fd < 0) return false;
+
+    if(!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        // needed to wait with a timeout
+        httpdUringDeinit(ring);
+        errno = ENOSYS;
+        return false;
+    }
+
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sqRing == MAP_FAILED)
+    {
+        ring->sqRing = NULL;
+        httpdUringDeinit(ring);
+        return false;
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cqRing = ring->sqRing;
+    } else
+    {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cqRing == MAP_FAILED)
+        {
+            ring->cqRing = NULL;
+            httpdUringDeinit(ring);
+            return false;
+        }
+    }
+
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        httpdUringDeinit(ring);
+        return false;
+    }
+
+    char *sq = ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + p.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    ring->sqLocalTail = *ring->sqTail;
+
+    // sqe i always sits in slot i of the index array
+    unsigned *sqArray = (unsigned *)(sq + p.sq_off.array);
+    for(unsigned i = 0; i < ring->sqEntries; i++)
+    {
+        sqArray[i] = i;
+    }
+
+    char *cq = ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + p.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return true;
+}
+
+void httpdUringDeinit(HttpdUring *ring)
+{
+    if(ring->bufRing) munmap(ring->bufRing, ring->bufRingSize);
+    free(ring->bufs);
+    if(ring->sqes) munmap(ring->sqes, ring->sqesSize);
+    if(ring->cqRing && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    if(ring->sqRing) munmap(ring->sqRing, ring->sqRingSize);
+    if(ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *httpdUringGetSqe(HttpdUring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if(ring->sqLocalTail - head >= ring->sqEntries)
+    {
+        httpdUringSubmitAndWait(ring, 0);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if(ring->sqLocalTail - head >= ring->sqEntries) return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqLocalTail & ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+int httpdUringSubmitAndWait(HttpdUring *ring, int timeoutMs)
+{
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    // completions of a ring set up with IORING_SETUP_DEFER_TASKRUN are only posted while
+    // asking for them, so always do that, just without waiting for a timeout of 0
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if(timeoutMs > 0)
+    {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    int ret = uringEnter(ring->fd, toSubmit, (timeoutMs != 0) ? 1 : 0,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if(ret < 0)
+    {
+        // ETIME: the timeout expired, EINTR: a signal arrived, both are fine
+        if((errno == ETIME) || (errno == EINTR)) return 0;
+        return -errno;
+    }
+    return ret;
+}
+
+unsigned httpdUringReap(HttpdUring *ring, struct io_uring_cqe *cqes, unsigned max)
+{
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+
+    while((head != tail) && (count < max))
+    {
+        cqes[count++] = ring->cqes[head & ring->cqMask];
+        head++;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+bool httpdUringSetupBuffers(HttpdUring *ring, unsigned bufGroup, unsigned count, unsigned size)
+{
+    ring->bufRingSize = count * sizeof(struct io_uring_buf);
+    ring->bufRing = mmap(NULL, ring->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring->bufRing == MAP_FAILED)
+    {
+        ring->bufRing = NULL;
+        return false;
+    }
+
+    ring->bufs = malloc((size_t)count * size);
+    if(!ring->bufs) return false;
+    ring->bufCount = count;
+    ring->bufSize = size;
+    ring->bufTail = 0;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+    reg.ring_entries = count;
+    reg.bgid = bufGroup;
+    if(uringRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) return false;
+
+    for(unsigned i = 0; i < count; i++)
+    {
+        httpdUringRecycleBuffer(ring, i);
+    }
+    return true;
+}
+
+void httpdUringRecycleBuffer(HttpdUring *ring, unsigned bufId)
+{
+    struct io_uring_buf *buf = &ring->bufRing->bufs[ring->bufTail & (ring->bufCount - 1)];
+    buf->addr = (uint64_t)(uintptr_t)httpdUringBuffer(ring, bufId);
+    buf->len = ring->bufSize;
+    buf->bid = bufId;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+#endif
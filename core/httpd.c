@@ -16,7 +16,11 @@ Http server - core routines
 #include <libesphttpd/esp.h>
 #endif
 
+#include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
 #include <strings.h>
+#include <unistd.h>
 
 #include "libesphttpd/httpd.h"
 #include "httpd-platform.h"
@@ -31,6 +35,12 @@ const static char* TAG = "httpd";
 #define HFL_SENDINGBODY (1<<2)
 #define HFL_DISCONAFTERSENT (1<<3)
 #define HFL_NOCONNECTIONSTR (1<<4)
+#define HFL_CONTENTLEN (1<<5)
+#define HFL_KEEPALIVE (1<<6)
+#define HFL_SENDFILE (1<<7)
+#define HFL_REUSED (1<<8)
+#define HFL_STREAMBODY (1<<9)
+#define HFL_CHUNKEDBODY (1<<10)
 
 
 const char *httpdCgiEx = "HttpdCgiExArg";
@@ -91,25 +101,243 @@ void httpdAddCacheHeaders(HttpdConnData *connData, const char *mime)
     httpdHeader(connData, "Cache-Control", "max-age=7200, public, must-revalidate");
 }
 
-//Retires a connection for re-use
-static void ICACHE_FLASH_ATTR httpdRetireConn(HttpdInstance *pInstance, HttpdConnData *conn) {
-#ifdef CONFIG_ESPHTTPD_BACKLOG_SUPPORT
-    if (conn->priv.sendBacklog!=NULL) {
-        HttpSendBacklogItem *i, *j;
-        i=conn->priv.sendBacklog;
-        do {
-            j=i;
-            i=i->next;
-            free(j);
-        } while (i!=NULL);
+//Take a buffer from the pool, malloc a new one of 'size' bytes if the pool is empty.
+static char ICACHE_FLASH_ATTR *httpdPoolGet(HttpdInstance *pInstance, HttpdBuffPool *pool, int size) {
+    void *buff=NULL;
+    httpdPlatLock(pInstance);
+    if (pool->freeList!=NULL) {
+        buff=pool->freeList;
+        pool->freeList=*(void**)buff;
+        pool->freeCount--;
     }
+    httpdPlatUnlock(pInstance);
+    if (buff==NULL) buff=malloc(size);
+    return buff;
+}
+
+//Return a buffer to the pool, or free it if the pool is full.
+static void ICACHE_FLASH_ATTR httpdPoolPut(HttpdInstance *pInstance, HttpdBuffPool *pool, char *buff) {
+    httpdPlatLock(pInstance);
+    if (pool->freeCount < HTTPD_BUFF_POOL_MAX) {
+        *(void**)buff=pool->freeList;
+        pool->freeList=buff;
+        pool->freeCount++;
+        buff=NULL;
+    }
+    httpdPlatUnlock(pInstance);
+    if (buff!=NULL) free(buff);
+}
+
+static void ICACHE_FLASH_ATTR httpdPoolDrain(HttpdBuffPool *pool) {
+    while (pool->freeList!=NULL) {
+        void *buff=pool->freeList;
+        pool->freeList=*(void**)buff;
+        free(buff);
+    }
+    pool->freeCount=0;
+}
+
+//Make sure the connection has a head buffer to receive a request into.
+static bool ICACHE_FLASH_ATTR httpdHeadAcquire(HttpdConnData *conn) {
+    if (conn->priv.head!=NULL) return true;
+    conn->priv.head=httpdPoolGet(conn->priv.instance, &conn->priv.instance->headPool, HTTPD_MAX_HEAD_LEN);
+    if (conn->priv.head==NULL) {
+        ESP_LOGE(TAG, "no memory for request head");
+        return false;
+    }
+    conn->priv.headSize=HTTPD_MAX_HEAD_LEN;
+    conn->priv.headPos=0;
+    conn->priv.headLine=0;
+    conn->priv.headerCount=0;
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR httpdHeadFree(HttpdConnData *conn, char *head, int headSize) {
+    if (headSize==HTTPD_MAX_HEAD_LEN) {
+        httpdPoolPut(conn->priv.instance, &conn->priv.instance->headPool, head);
+    } else {
+        free(head);
+    }
+}
+
+//Grow the head buffer, up to HTTPD_MAX_HEAD_GROW_LEN. Only called while the head is being
+//received. The lines received so far are already parsed, so move the pointers into it along.
+static bool ICACHE_FLASH_ATTR httpdHeadGrow(HttpdConnData *conn) {
+    if (conn->priv.headSize>=HTTPD_MAX_HEAD_GROW_LEN) return false;
+    int newSize=conn->priv.headSize*2;
+    if (newSize>HTTPD_MAX_HEAD_GROW_LEN) newSize=HTTPD_MAX_HEAD_GROW_LEN;
+    char *newHead=malloc(newSize);
+    if (newHead==NULL) {
+        ESP_LOGE(TAG, "no memory to grow request head to %d bytes", newSize);
+        return false;
+    }
+    memcpy(newHead, conn->priv.head, conn->priv.headPos+1);
+    if (conn->url!=NULL) conn->url=newHead+(conn->url-conn->priv.head);
+    if (conn->getArgs!=NULL) conn->getArgs=newHead+(conn->getArgs-conn->priv.head);
+    if (conn->hostName!=NULL) conn->hostName=newHead+(conn->hostName-conn->priv.head);
+    if (conn->post.multipartBoundary!=NULL) {
+        conn->post.multipartBoundary=newHead+(conn->post.multipartBoundary-conn->priv.head);
+    }
+#ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
+    if (conn->priv.corsToken!=NULL) conn->priv.corsToken=newHead+(conn->priv.corsToken-conn->priv.head);
 #endif
+    httpdHeadFree(conn, conn->priv.head, conn->priv.headSize);
+    conn->priv.head=newHead;
+    conn->priv.headSize=newSize;
+    return true;
+}
+
+//Give the head buffer back once the request has been handled. Clears all pointers into it.
+static void ICACHE_FLASH_ATTR httpdHeadRelease(HttpdConnData *conn) {
+    if (conn->priv.head==NULL) return;
+    httpdHeadFree(conn, conn->priv.head, conn->priv.headSize);
+    conn->priv.head=NULL;
+    conn->priv.headSize=0;
+    conn->priv.headPos=0;
+    conn->priv.headLine=0;
+    conn->priv.headerCount=0;
+    conn->url=NULL;
+    conn->getArgs=NULL;
+    conn->hostName=NULL;
+    conn->post.multipartBoundary=NULL;
+#ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
+    conn->priv.corsToken=NULL;
+#endif
+}
+
+//Make sure the connection has a send buffer.
+static bool ICACHE_FLASH_ATTR httpdSendBuffAcquire(HttpdConnData *conn) {
+    if (conn->priv.sendBuff!=NULL) return true;
+    conn->priv.sendBuff=httpdPoolGet(conn->priv.instance, &conn->priv.instance->sendBuffPool, HTTPD_SENDBUFF_SIZE);
+    if (conn->priv.sendBuff==NULL) {
+        ESP_LOGE(TAG, "no memory for send buffer");
+        return false;
+    }
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR httpdSendBuffRelease(HttpdConnData *conn) {
+    if (conn->priv.sendBuff==NULL) return;
+    httpdPoolPut(conn->priv.instance, &conn->priv.instance->sendBuffPool, conn->priv.sendBuff);
+    conn->priv.sendBuff=NULL;
+    conn->priv.sendBuffLen=0;
+    conn->priv.sendBuffPos=0;
+    conn->priv.chunkHdr=NULL;
+}
+
+//Move the data that still has to be written to the socket to the start of the send buffer.
+static void ICACHE_FLASH_ATTR httpdSendBuffCompact(HttpdConnData *conn) {
+    int pos=conn->priv.sendBuffPos;
+    if (pos==0) return;
+    memmove(conn->priv.sendBuff, conn->priv.sendBuff+pos, conn->priv.sendBuffLen-pos);
+    conn->priv.sendBuffLen-=pos;
+    conn->priv.sendBuffPos=0;
+    //An open chunk always starts after the data that was already written
+    if (conn->priv.chunkHdr!=NULL) conn->priv.chunkHdr-=pos;
+    for (int i=0; i<conn->priv.sendRefCount; i++) conn->priv.sendRefs[i].buffEnd-=pos;
+}
+
+//Drop the first buffer queued with httpdSendRef() and tell its owner.
+static void ICACHE_FLASH_ATTR httpdSendRefPop(HttpdConnData *conn) {
+    HttpdSendRef ref=conn->priv.sendRefs[0];
+    conn->priv.sendRefCount--;
+    memmove(&conn->priv.sendRefs[0], &conn->priv.sendRefs[1], conn->priv.sendRefCount*sizeof(HttpdSendRef));
+    if (ref.doneCb) ref.doneCb(ref.doneArg);
+}
+
+//Account for len bytes that were written to the socket, in the order the data was queued.
+static void ICACHE_FLASH_ATTR httpdSendConsume(HttpdConnData *conn, size_t len) {
+    while (len>0) {
+        int buffEnd=(conn->priv.sendRefCount>0)?conn->priv.sendRefs[0].buffEnd:conn->priv.sendBuffLen;
+        if (conn->priv.sendBuffPos<buffEnd) {
+            size_t n=buffEnd-conn->priv.sendBuffPos;
+            if (n>len) n=len;
+            conn->priv.sendBuffPos+=n;
+            len-=n;
+        } else if (conn->priv.sendRefCount>0) {
+            HttpdSendRef *ref=&conn->priv.sendRefs[0];
+            size_t n=(ref->len>len)?len:ref->len;
+            ref->data+=n;
+            ref->len-=n;
+            len-=n;
+            if (ref->len==0) httpdSendRefPop(conn);
+        } else {
+            break;
+        }
+    }
+}
+
+//Block of the connection arena, the memory handed out follows the header.
+struct HttpdArenaBlock {
+    HttpdArenaBlock *next;
+    size_t size;            // of the whole block, blocks of HTTPD_ARENA_SIZE go back to the pool
+    size_t used;
+};
+
+#define ARENA_ALIGN(n) (((n)+_Alignof(max_align_t)-1)&~(size_t)(_Alignof(max_align_t)-1))
+#define ARENA_HDR_LEN ARENA_ALIGN(sizeof(HttpdArenaBlock))
+
+void ICACHE_FLASH_ATTR *httpdArenaAlloc(HttpdConnData *conn, size_t len) {
+    HttpdArenaBlock *block=conn->priv.arena;
+    len=ARENA_ALIGN(len);
+    if (block==NULL || block->size-block->used<len) {
+        //Start a new block, what's left of the current one stays unused
+        size_t size=HTTPD_ARENA_SIZE;
+        if (len>HTTPD_ARENA_SIZE-ARENA_HDR_LEN) {
+            size=ARENA_HDR_LEN+len;
+            block=malloc(size);
+        } else {
+            block=(HttpdArenaBlock*)httpdPoolGet(conn->priv.instance, &conn->priv.instance->arenaPool, HTTPD_ARENA_SIZE);
+        }
+        if (block==NULL) {
+            ESP_LOGE(TAG, "no memory for %u bytes of request arena", (unsigned)len);
+            return NULL;
+        }
+        block->next=conn->priv.arena;
+        block->size=size;
+        block->used=ARENA_HDR_LEN;
+        conn->priv.arena=block;
+    }
+    void *ret=(char*)block+block->used;
+    block->used+=len;
+    return ret;
+}
 
-    if (conn->post.buff)
+//Release everything allocated with httpdArenaAlloc() for the request.
+static void ICACHE_FLASH_ATTR httpdArenaRelease(HttpdConnData *conn) {
+    while (conn->priv.arena!=NULL) {
+        HttpdArenaBlock *block=conn->priv.arena;
+        conn->priv.arena=block->next;
+        if (block->size==HTTPD_ARENA_SIZE) {
+            httpdPoolPut(conn->priv.instance, &conn->priv.instance->arenaPool, (char*)block);
+        } else {
+            free(block);
+        }
+    }
+}
+
+//Drop the POST buffer, it lives in the connection arena. A streamed request body isn't
+//buffered, post.buff points at received data then.
+static void ICACHE_FLASH_ATTR httpdPostBuffRelease(HttpdConnData *conn) {
+    conn->post.buff=NULL;
+}
+
+//Retires a connection for re-use
+static void ICACHE_FLASH_ATTR httpdRetireConn(HttpdInstance *pInstance, HttpdConnData *conn) {
+    httpdPostBuffRelease(conn);
+
+    if (conn->priv.pipeBuff)
     {
-        free(conn->post.buff);
-        conn->post.buff = NULL;
+        free(conn->priv.pipeBuff);
+        conn->priv.pipeBuff = NULL;
+        conn->priv.pipeLen = 0;
     }
+
+    httpdHeadRelease(conn);
+    httpdArenaRelease(conn);
+    while (conn->priv.sendRefCount>0) httpdSendRefPop(conn);
+    httpdSendBuffRelease(conn);
+    conn->priv.sendFdLeft=0;
 }
 
 //Stupid li'l helper function that returns the value of a hex char.
@@ -123,24 +351,28 @@ static int ICACHE_FLASH_ATTR  httpdHexVal(char c) {
 bool ICACHE_FLASH_ATTR httpdUrlDecode(const char *val, int valLen, char *ret, int retLen, int* bytesWritten) {
     int s=0; // index of theread position in val
     int d=0; // index of the write position in 'ret'
-    int esced=0, escVal=0;
-    // d loops for (retLen - 1) to ensure there is space for the null terminator
+    // d stays below (retLen - 1) to ensure there is space for the null terminator
     while (s<valLen && d < (retLen - 1)) {
-        if (esced==1)  {
-            escVal=httpdHexVal(val[s])<<4;
-            esced=2;
-        } else if (esced==2) {
-            escVal+=httpdHexVal(val[s]);
-            ret[d++]=escVal;
-            esced=0;
-        } else if (val[s]=='%') {
-            esced=1;
-        } else if (val[s]=='+') {
+        //Copy the run of plain characters up to the next escape in one go
+        int e=s;
+        while (e<valLen && val[e]!='%' && val[e]!='+') e++;
+        int n=e-s;
+        if (n>retLen-1-d) n=retLen-1-d;
+        memcpy(&ret[d], &val[s], n);
+        d+=n;
+        s+=n;
+        if (s!=e || s==valLen || d==retLen-1) continue;
+
+        if (val[s]=='+') {
             ret[d++]=' ';
+            s++;
+        } else if (s+2<valLen) {
+            ret[d++]=(httpdHexVal(val[s+1])<<4)+httpdHexVal(val[s+2]);
+            s+=3;
         } else {
-            ret[d++]=val[s];
+            //Incomplete escape at the end, dropped
+            s=valLen;
         }
-        s++;
     }
 
     ret[d++] = 0;
@@ -150,6 +382,50 @@ bool ICACHE_FLASH_ATTR httpdUrlDecode(const char *val, int valLen, char *ret, in
     return (s == valLen) ? true : false;
 }
 
+#ifdef CONFIG_ESPHTTPD_SANITIZE_URLS
+//Normalize the path of a request url in place, in a single pass: percent-escapes are decoded,
+//repeated slashes collapsed and '.' and '..' segments resolved, never going above the root.
+//A %00 escape is left as it is. Paths that don't start with '/' (eg. '*') are not touched.
+static void ICACHE_FLASH_ATTR httpdNormalizePath(char *path) {
+    const char *r=path;
+    char *w=path;
+    char *seg;  // start of the segment being written
+    if (*r!='/') return;
+
+    seg=w;
+    while (1) {
+        char c=*r;
+        if (c=='%' && isxdigit((unsigned char)r[1]) && isxdigit((unsigned char)r[2]) &&
+            (r[1]!='0' || r[2]!='0')) {
+            c=(httpdHexVal(r[1])<<4)+httpdHexVal(r[2]);
+            r+=3;
+        } else if (c!=0) {
+            r++;
+        }
+
+        if (c=='/' || c==0) {
+            //End of a segment, resolve it if it's a dot segment
+            if (w-seg==1 && seg[0]=='.') {
+                w=seg;
+            } else if (w-seg==2 && seg[0]=='.' && seg[1]=='.') {
+                w=seg;
+                //Drop the segment before it as well, if there is one
+                if (w-1>path) {
+                    w--;
+                    while (w[-1]!='/') w--;
+                }
+            }
+            if (c==0) break;
+            if (w==path || w[-1]!='/') *w++='/';
+            seg=w;
+        } else {
+            *w++=c;
+        }
+    }
+    *w=0;
+}
+#endif // CONFIG_ESPHTTPD_SANITIZE_URLS
+
 //Find a specific arg in a string of get- or post-data.
 //Line is the string of post/get-data, arg is the name of the value to find. The
 //zero-terminated result is written in buff, with at most buffLen bytes used. The
@@ -180,34 +456,195 @@ int ICACHE_FLASH_ATTR httpdFindArg(const char *line, const char *arg, char *buff
     return -1; //not found
 }
 
-bool ICACHE_FLASH_ATTR httpdGetHeader(HttpdConnData *conn, const char *header, char *ret, int retLen) {
-    bool retval = false;
-
-    char *p=conn->priv.head;
-    p=p+strlen(p)+1; //skip GET/POST part
-    p=p+strlen(p)+1; //skip HTTP part
-    while (p<(conn->priv.head+conn->priv.headPos)) {
-        while(*p<=32 && *p!=0) p++; //skip crap at start
-        //See if this is the header
-        if (strncasecmp(p, header, strlen(header))==0 && p[strlen(header)]==':') {
-            //Skip 'key:' bit of header line
-            p=p+strlen(header)+1;
-            //Skip past spaces after the colon
-            while(*p==' ') p++;
-            //Copy from p to end
-            // retLen check preserves one byte in ret so we can null terminate
-            while (*p!=0 && *p!='\r' && *p!='\n' && retLen>1) {
-                *ret++=*p++;
-                retLen--;
+int ICACHE_FLASH_ATTR httpdParseArgs(const char *line, HttpdArgs *args) {
+    const char *p=line;
+    args->count=0;
+    if (line==NULL) return 0;
+    while (*p!='\n' && *p!='\r' && *p!=0) {
+        //The value runs up to the next '&', the name up to the '=' in front of it
+        const char *e=strchr(p, '&');
+        if (e==NULL) e=p+strlen(p);
+        const char *eq=memchr(p, '=', e-p);
+        if (eq!=NULL) {
+            if (args->count==HTTPD_MAX_ARGS) {
+                ESP_LOGW(TAG, "more than %d args, ignoring the rest", HTTPD_MAX_ARGS);
+                break;
             }
-            //Zero-terminate string
-            *ret=0;
-            retval = true;
+            HttpdArg *arg=&args->args[args->count++];
+            arg->name=p;
+            arg->nameLen=eq-p;
+            arg->value=eq+1;
+            arg->valueLen=e-(eq+1);
+        }
+        if (*e==0) break;
+        p=e+1;
+    }
+    return args->count;
+}
+
+const HttpdArg ICACHE_FLASH_ATTR *httpdArgsFind(const HttpdArgs *args, const char *name) {
+    const size_t nameLen=strlen(name);
+    for (int i=0; i<args->count; i++) {
+        const HttpdArg *arg=&args->args[i];
+        if ((size_t)arg->nameLen==nameLen && memcmp(arg->name, name, nameLen)==0) return arg;
+    }
+    return NULL;
+}
+
+int ICACHE_FLASH_ATTR httpdArgValue(const HttpdArg *arg, char *buff, int buffLen) {
+    int bytesWritten;
+    if (!httpdUrlDecode(arg->value, arg->valueLen, buff, buffLen, &bytesWritten)) {
+        ESP_LOGE(TAG, "out of space storing arg");
+    }
+    return bytesWritten;
+}
+
+//Get the value of arg to convert to a number. It's only decoded if it has escapes, into buff.
+//Returns NULL if the decoded value doesn't fit, it's too long to be a number then.
+static const char ICACHE_FLASH_ATTR *httpdArgNumber(const HttpdArg *arg, char *buff, int buffLen, int *len) {
+    if (memchr(arg->value, '%', arg->valueLen)==NULL && memchr(arg->value, '+', arg->valueLen)==NULL) {
+        *len=arg->valueLen;
+        return arg->value;
+    }
+    if (!httpdUrlDecode(arg->value, arg->valueLen, buff, buffLen, len)) return NULL;
+    (*len)--; //the terminating zero
+    return buff;
+}
+
+//Convert len chars of digits in base 10 or 16, nothing else, to a number. Fails on overflow.
+static bool ICACHE_FLASH_ATTR httpdParseU32(const char *p, int len, int base, uint32_t *value) {
+    uint32_t v=0;
+    if (len==0) return false;
+    for (int i=0; i<len; i++) {
+        int d;
+        if (p[i]>='0' && p[i]<='9') d=p[i]-'0';
+        else if (base==16 && isxdigit((unsigned char)p[i])) d=httpdHexVal(p[i]);
+        else return false;
+        if (v>(UINT32_MAX-d)/base) return false;
+        v=v*base+d;
+    }
+    *value=v;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR httpdArgToS32(const HttpdArg *arg, int32_t *value) {
+    char buff[16];
+    int len;
+    uint32_t v;
+    const char *p=httpdArgNumber(arg, buff, sizeof(buff), &len);
+    if (p==NULL) return false;
+    while (len>0 && *p==' ') { p++; len--; }
+    bool neg=(len>0 && *p=='-');
+    if (len>0 && (*p=='-' || *p=='+')) { p++; len--; }
+    if (!httpdParseU32(p, len, 10, &v)) return false;
+    if (v>(neg?(uint32_t)INT32_MAX+1:(uint32_t)INT32_MAX)) return false;
+    *value=neg?(int32_t)(0-v):(int32_t)v;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR httpdArgToU32(const HttpdArg *arg, uint32_t *value) {
+    char buff[16];
+    int len;
+    const char *p=httpdArgNumber(arg, buff, sizeof(buff), &len);
+    if (p==NULL) return false;
+    while (len>0 && *p==' ') { p++; len--; }
+    if (len>0 && *p=='+') { p++; len--; }
+    return httpdParseU32(p, len, 10, value);
+}
+
+bool ICACHE_FLASH_ATTR httpdArgToHexU32(const HttpdArg *arg, uint32_t *value) {
+    char buff[16];
+    int len;
+    const char *p=httpdArgNumber(arg, buff, sizeof(buff), &len);
+    if (p==NULL) return false;
+    while (len>0 && *p==' ') { p++; len--; }
+    if (len>2 && p[0]=='0' && (p[1]=='x' || p[1]=='X')) { p+=2; len-=2; }
+    return httpdParseU32(p, len, 16, value);
+}
+
+//Hash of a header name, case insensitive.
+static uint16_t ICACHE_FLASH_ATTR httpdHeaderHash(const char *name, int len) {
+    uint32_t h=2166136261u; //FNV-1a
+    for (int i=0; i<len; i++) {
+        h^=(uint8_t)tolower((unsigned char)name[i]);
+        h*=16777619u;
+    }
+    return (uint16_t)(h^(h>>16));
+}
+
+//Add a received header line to the header index of the request.
+static void ICACHE_FLASH_ATTR httpdIndexHeader(HttpdConnData *conn, char *line, char *end) {
+    char *colon=memchr(line, ':', end-line);
+    if (colon==NULL || colon==line) return;
+    if (conn->priv.headerCount>=HTTPD_MAX_HEADERS) {
+        ESP_LOGW(TAG, "too many request headers, ignoring %.*s", (int)(colon-line), line);
+        return;
+    }
+
+    char *v=colon+1;
+    while (v<end && (*v==' ' || *v=='\t')) v++;
+    while (end>v && (end[-1]==' ' || end[-1]=='\t')) end--;
+    *end=0; //Values are handed out as strings
+
+    HttpdHeaderEntry *entry=&conn->priv.headers[conn->priv.headerCount++];
+    entry->nameHash=httpdHeaderHash(line, colon-line);
+    entry->nameLen=colon-line;
+    entry->lineOff=line-conn->priv.head;
+    entry->valueOff=v-conn->priv.head;
+    entry->valueLen=end-v;
+}
+
+bool ICACHE_FLASH_ATTR httpdGetHeaderView(HttpdConnData *conn, const char *header, const char **value, int *valueLen) {
+    if (conn->priv.head==NULL) return false;
+
+    int len=strlen(header);
+    uint16_t hash=httpdHeaderHash(header, len);
+    //Search backwards, the last one of a repeated header wins
+    for (int i=conn->priv.headerCount-1; i>=0; i--) {
+        const HttpdHeaderEntry *entry=&conn->priv.headers[i];
+        if (entry->nameHash==hash && entry->nameLen==len &&
+                strncasecmp(&conn->priv.head[entry->lineOff], header, len)==0) {
+            *value=&conn->priv.head[entry->valueOff];
+            if (valueLen) *valueLen=entry->valueLen;
+            return true;
         }
-        p+=strlen(p)+1; //Skip past end of string and \0 terminator
     }
+    return false;
+}
 
-    return retval;
+bool ICACHE_FLASH_ATTR httpdGetHeader(HttpdConnData *conn, const char *header, char *ret, int retLen) {
+    const char *value;
+    int len;
+
+    if (!httpdGetHeaderView(conn, header, &value, &len)) return false;
+    // retLen check preserves one byte in ret so we can null terminate
+    if (len>retLen-1) len=retLen-1;
+    memcpy(ret, value, len);
+    //Zero-terminate string
+    ret[len]=0;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR httpdGetCookie(HttpdConnData *conn, const char *name, const char **value, int *valueLen) {
+    const char *p, *end;
+    int len;
+
+    if (!httpdGetHeaderView(conn, "Cookie", &p, &len)) return false;
+    end=p+len;
+    int nameLen=strlen(name);
+    while (p<end) {
+        while (p<end && (*p==' ' || *p==';')) p++;
+        //Cookies are separated by "; "
+        const char *e=memchr(p, ';', end-p);
+        if (e==NULL) e=end;
+        if (e-p>nameLen && strncmp(p, name, nameLen)==0 && p[nameLen]=='=') {
+            *value=p+nameLen+1;
+            *valueLen=e-*value;
+            return true;
+        }
+        p=e;
+    }
+    return false;
 }
 
 void ICACHE_FLASH_ATTR httpdSetTransferMode(HttpdConnData *conn, TransferModes mode) {
@@ -223,16 +660,32 @@ void ICACHE_FLASH_ATTR httpdSetTransferMode(HttpdConnData *conn, TransferModes m
     }
 }
 
+void ICACHE_FLASH_ATTR httpdSetContentLength(HttpdConnData *conn, long len) {
+    conn->priv.contentLen=len;
+    conn->priv.flags|=HFL_CONTENTLEN;
+    if (conn->priv.flags&HFL_CHUNKED) {
+        //The length delimits the body, a keep-alive connection doesn't need chunking for that
+        conn->priv.flags&=~HFL_CHUNKED;
+        conn->priv.flags|=HFL_KEEPALIVE;
+    }
+}
+
 //Start the response headers.
 void ICACHE_FLASH_ATTR httpdStartResponse(HttpdConnData *conn, int code) {
     char buff[128];
+    char lenStr[32]="";
     int l;
     const char *connStr="Connection: close\r\n";
+    if (conn->priv.flags&HFL_KEEPALIVE) connStr="";
     if (conn->priv.flags&HFL_CHUNKED) connStr="Transfer-Encoding: chunked\r\n";
     if (conn->priv.flags&HFL_NOCONNECTIONSTR) connStr="";
-    l=snprintf(buff, sizeof(buff), "HTTP/1.%d %d OK\r\nServer: esp-httpd/"HTTPDVER"\r\n%s",
+    if (conn->priv.flags&HFL_CONTENTLEN) {
+        snprintf(lenStr, sizeof(lenStr), "Content-Length: %ld\r\n", conn->priv.contentLen);
+    }
+    l=snprintf(buff, sizeof(buff), "HTTP/1.%d %d OK\r\nServer: esp-httpd/"HTTPDVER"\r\n%s%s",
                 (conn->priv.flags&HFL_HTTP11)?1:0,
                 code,
+                lenStr,
                 connStr);
     if(l >= sizeof(buff))
     {
@@ -243,7 +696,7 @@ void ICACHE_FLASH_ATTR httpdStartResponse(HttpdConnData *conn, int code) {
 #ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
     // CORS headers
     httpdSend(conn, "Access-Control-Allow-Origin: *\r\n", -1);
-    httpdSend(conn, "Access-Control-Allow-Methods: GET,POST,PUT,DELETE,OPTIONS\r\n", -1);
+    httpdSend(conn, "Access-Control-Allow-Methods: GET,HEAD,POST,PUT,DELETE,OPTIONS\r\n", -1);
 #endif
 }
 
@@ -273,35 +726,50 @@ void ICACHE_FLASH_ATTR httpdRedirect(HttpdConnData *conn, const char *newUrl) {
 //Used to spit out a 404 error
 static CgiStatus ICACHE_FLASH_ATTR cgiNotFound(HttpdConnData *connData) {
     if (connData->isConnectionClosed) return HTTPD_CGI_DONE;
-    if (connData->post.received == connData->post.len)
-    {
-        httpdStartResponse(connData, 404);
-        httpdEndHeaders(connData);
-        httpdSend(connData, "404 File not found.", -1);
-        return HTTPD_CGI_DONE;
-    }
-    return HTTPD_CGI_MORE; // make sure to eat-up all the post data that the client may be sending!
+    //Don't eat up the rest of the post data the client may be sending, close the connection instead
+    if (connData->post.received < connData->post.len) httpdSetTransferMode(connData, HTTPD_TRANSFER_CLOSE);
+    httpdStartResponse(connData, 404);
+    httpdEndHeaders(connData);
+    httpdSend(connData, "404 File not found.", -1);
+    return HTTPD_CGI_DONE;
 }
 
 static const char* CHUNK_SIZE_TEXT = "0000\r\n";
 static const int CHUNK_SIZE_TEXT_LEN = 6; // number of characters in CHUNK_SIZE_TEXT
+#define CHUNK_REF_HDR_MAX_LEN (sizeof(unsigned long)*2+2) // "%lx\r\n" header of a httpdSendRef() chunk
+
+//Open a new chunk at the end of the send buffer, if the response is chunked and no chunk is open.
+//The caller makes sure there is room for the chunk header.
+static void ICACHE_FLASH_ATTR httpdSendChunkStart(HttpdConnData *conn) {
+    if (conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY && conn->priv.chunkHdr==NULL)
+    {
+        // Establish start of chunk
+        // Use a chunk length placeholder of 4 characters
+        conn->priv.chunkHdr = &conn->priv.sendBuff[conn->priv.sendBuffLen];
+        memcpy(conn->priv.chunkHdr, CHUNK_SIZE_TEXT, CHUNK_SIZE_TEXT_LEN);
+        conn->priv.sendBuffLen+=CHUNK_SIZE_TEXT_LEN;
+        assert(conn->priv.sendBuffLen <= HTTPD_SENDBUFF_MAX_FILL);
+    }
+}
+
+//The response to a HEAD request stops after the headers, body data is dropped.
+#define HTTPD_DROPS_BODY(conn) ((conn)->requestType==HTTPD_METHOD_HEAD && ((conn)->priv.flags&HFL_SENDINGBODY))
 
-//Add data to the send buffer. len is the length of the data. If len is -1
 //the data is seen as a C-string.
 //Returns 1 for success, 0 for out-of-memory.
 int ICACHE_FLASH_ATTR httpdSend(HttpdConnData *conn, const char *data, int len) {
     if (len<0) len=strlen(data);
     if (len==0) return 0;
+    if (HTTPD_DROPS_BODY(conn)) return 1;
+    if (!httpdSendBuffAcquire(conn)) return 0;
+    if (conn->priv.sendBuffPos>0 && conn->priv.sendBuffLen+len+CHUNK_SIZE_TEXT_LEN > HTTPD_SENDBUFF_MAX_FILL) {
+        //Make room behind the data that is still waiting for the socket
+        httpdSendBuffCompact(conn);
+    }
     if (conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY && conn->priv.chunkHdr==NULL)
     {
         if (conn->priv.sendBuffLen+len+CHUNK_SIZE_TEXT_LEN > HTTPD_SENDBUFF_MAX_FILL) return 0;
-
-        // Establish start of chunk
-        // Use a chunk length placeholder of 4 characters
-        conn->priv.chunkHdr = &conn->priv.sendBuff[conn->priv.sendBuffLen];
-        strcpy(conn->priv.chunkHdr, CHUNK_SIZE_TEXT);
-        conn->priv.sendBuffLen+=CHUNK_SIZE_TEXT_LEN;
-        assert(conn->priv.sendBuffLen <= HTTPD_SENDBUFF_MAX_FILL);
+        httpdSendChunkStart(conn);
     }
     if (conn->priv.sendBuffLen+len > HTTPD_SENDBUFF_MAX_FILL) return 0;
     memcpy(conn->priv.sendBuff+conn->priv.sendBuffLen, data, len);
@@ -317,6 +785,68 @@ static char ICACHE_FLASH_ATTR httpdHexNibble(int val)
     return 'A'+(val-10);
 }
 
+//Close the chunk opened by httpdSendChunkStart(), if any.
+static void ICACHE_FLASH_ATTR httpdSendChunkEnd(HttpdConnData *conn) {
+    int len;
+    if (conn->priv.chunkHdr!=NULL) {
+        //We're sending chunked data, and the chunk needs fixing up.
+        //Finish chunk with cr/lf
+        if(conn->priv.sendBuffLen + 2 <= HTTPD_SENDBUFF_SIZE) {
+            // Add chunk closing.
+            memcpy(&conn->priv.sendBuff[conn->priv.sendBuffLen], "\r\n", 2);
+            conn->priv.sendBuffLen += 2;
+            assert(conn->priv.sendBuffLen <= HTTPD_SENDBUFF_SIZE);
+        } else {
+            ESP_LOGE(TAG, "sendBuff full");
+        }
+        //Calculate length of chunk
+        // +2 is to remove the two characters written above via httpdSend(), those
+        // bytes aren't counted in the chunk length
+        len=((&conn->priv.sendBuff[conn->priv.sendBuffLen])-conn->priv.chunkHdr) - (CHUNK_SIZE_TEXT_LEN + 2);
+        //Fix up chunk header to correct value
+        conn->priv.chunkHdr[0]=httpdHexNibble(len>>12);
+        conn->priv.chunkHdr[1]=httpdHexNibble(len>>8);
+        conn->priv.chunkHdr[2]=httpdHexNibble(len>>4);
+        conn->priv.chunkHdr[3]=httpdHexNibble(len>>0);
+        //Reset chunk hdr for next call
+        conn->priv.chunkHdr=NULL;
+    }
+}
+
+int ICACHE_FLASH_ATTR httpdSendRef(HttpdConnData *conn, const void *data, size_t len, httpdSendRefDoneCb doneCb, void *doneArg) {
+    HttpdSendRef *ref;
+    bool chunked;
+    if (conn->priv.sendRefCount>=HTTPD_MAX_SEND_REFS) return 0;
+    if (len==0 || HTTPD_DROPS_BODY(conn)) {
+        if (doneCb) doneCb(doneArg);
+        return 1;
+    }
+
+    chunked=(conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY);
+    if (chunked) {
+        //The buffer goes out as a chunk of its own: the header is put in the send buffer in front
+        //of it, the trailing cr/lf behind it.
+        if (!httpdSendBuffAcquire(conn)) return 0;
+        httpdSendBuffCompact(conn);
+        if (conn->priv.sendBuffLen+2+CHUNK_REF_HDR_MAX_LEN+2 > HTTPD_SENDBUFF_MAX_FILL) return 0;
+        httpdSendChunkEnd(conn);
+        conn->priv.sendBuffLen+=sprintf(conn->priv.sendBuff+conn->priv.sendBuffLen, "%lx\r\n", (unsigned long)len);
+    }
+
+    ref=&conn->priv.sendRefs[conn->priv.sendRefCount++];
+    ref->data=data;
+    ref->len=len;
+    ref->buffEnd=conn->priv.sendBuffLen;
+    ref->doneCb=doneCb;
+    ref->doneArg=doneArg;
+
+    if (chunked) {
+        memcpy(conn->priv.sendBuff+conn->priv.sendBuffLen, "\r\n", 2);
+        conn->priv.sendBuffLen+=2;
+    }
+    return 1;
+}
+
 #define httpdSend_orDie(conn, data, len) do { if (!httpdSend((conn), (data), (len))) return false; } while (0)
 
 /* encode for HTML. returns 0 or 1 - 1 = success */
@@ -386,37 +916,72 @@ int ICACHE_FLASH_ATTR httpdSend_js(HttpdConnData *conn, const char *data, int le
     return 1;
 }
 
+int ICACHE_FLASH_ATTR httpdSendFd(HttpdConnData *conn, int fd, off_t offset, size_t len) {
+    if (conn->priv.sendFdLeft>0) return 0;
+    if (len==0 || HTTPD_DROPS_BODY(conn)) return 1;
+    conn->priv.sendFd=fd;
+    conn->priv.sendFdOffset=offset;
+    conn->priv.sendFdLeft=len;
+    //Chunk headers have to be interleaved with the data, that needs the copy path
+    if (!(conn->priv.flags&HFL_CHUNKED) && httpdPlatCanSendFile(conn->priv.instance, conn)) {
+        conn->priv.flags|=HFL_SENDFILE;
+    } else {
+        conn->priv.flags&=~HFL_SENDFILE;
+    }
+    return 1;
+}
+
+//Read the next part of the file queued with httpdSendFd() into the free space of the send buffer.
+static void ICACHE_FLASH_ATTR httpdSendFdFill(HttpdConnData *conn) {
+    int hdrLen=0;
+    int room;
+    ssize_t r;
+
+    if (!httpdSendBuffAcquire(conn)) return;
+    httpdSendBuffCompact(conn);
+    if (conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY && conn->priv.chunkHdr==NULL) {
+        hdrLen=CHUNK_SIZE_TEXT_LEN;
+    }
+    room=HTTPD_SENDBUFF_MAX_FILL-conn->priv.sendBuffLen-hdrLen;
+    if (room<=0) return;
+    if ((size_t)room>conn->priv.sendFdLeft) room=conn->priv.sendFdLeft;
+
+    //Read behind the space for the chunk header, the header is only written when there is data
+    r=pread(conn->priv.sendFd, conn->priv.sendBuff+conn->priv.sendBuffLen+hdrLen, room, conn->priv.sendFdOffset);
+    if (r<=0) {
+        ESP_LOGE(TAG, "read of fd %d failed, dropping %u bytes", conn->priv.sendFd, (unsigned)conn->priv.sendFdLeft);
+        conn->priv.sendFdLeft=0;
+        httpdPlatDisconnect(conn);
+        return;
+    }
+    httpdSendChunkStart(conn);
+    conn->priv.sendBuffLen+=r;
+    conn->priv.sendFdOffset+=r;
+    conn->priv.sendFdLeft-=r;
+}
+
 //Function to send any data in conn->priv.sendBuff. Do not use in CGIs unless you know what you
 //are doing! Also, if you do set conn->cgi to NULL to indicate the connection is closed, do it BEFORE
 //calling this.
 void ICACHE_FLASH_ATTR httpdFlushSendBuffer(HttpdInstance *pInstance, HttpdConnData *conn)
 {
-    int r, len;
-    if (conn->priv.chunkHdr!=NULL) {
-        //We're sending chunked data, and the chunk needs fixing up.
-        //Finish chunk with cr/lf
-        if(conn->priv.sendBuffLen + 2 <= HTTPD_SENDBUFF_SIZE) {
-            // Add chunk closing.
-            memcpy(&conn->priv.sendBuff[conn->priv.sendBuffLen], "\r\n", 2);
-            conn->priv.sendBuffLen += 2;
-            assert(conn->priv.sendBuffLen <= HTTPD_SENDBUFF_SIZE);
-        } else {
-            ESP_LOGE(TAG, "sendBuff full");
-        }
-        //Calculate length of chunk
-        // +2 is to remove the two characters written above via httpdSend(), those
-        // bytes aren't counted in the chunk length
-        len=((&conn->priv.sendBuff[conn->priv.sendBuffLen])-conn->priv.chunkHdr) - (CHUNK_SIZE_TEXT_LEN + 2);
-        //Fix up chunk header to correct value
-        conn->priv.chunkHdr[0]=httpdHexNibble(len>>12);
-        conn->priv.chunkHdr[1]=httpdHexNibble(len>>8);
-        conn->priv.chunkHdr[2]=httpdHexNibble(len>>4);
-        conn->priv.chunkHdr[3]=httpdHexNibble(len>>0);
-        //Reset chunk hdr for next call
-        conn->priv.chunkHdr=NULL;
+    int r;
+    if (conn->priv.sendFdLeft>0 && !(conn->priv.flags&HFL_SENDFILE)) {
+        httpdSendFdFill(conn);
     }
-    if (conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY && conn->cgi==NULL) {
-        if(conn->priv.sendBuffLen + 5 <= HTTPD_SENDBUFF_SIZE)
+    httpdSendChunkEnd(conn);
+    if (conn->priv.flags&HFL_CHUNKED && conn->priv.flags&HFL_SENDINGBODY && conn->cgi==NULL && !HTTPD_DROPS_BODY(conn)) {
+        if(!httpdSendBuffAcquire(conn))
+        {
+            // error logged by httpdSendBuffAcquire()
+        } else if(conn->priv.sendBuffLen + 5 > HTTPD_SENDBUFF_SIZE && conn->priv.sendBuffPos > 0)
+        {
+            httpdSendBuffCompact(conn);
+        }
+        if(conn->priv.sendBuff == NULL)
+        {
+            // error logged by httpdSendBuffAcquire()
+        } else if(conn->priv.sendBuffLen + 5 <= HTTPD_SENDBUFF_SIZE)
         {
             //Connection finished sending whatever needs to be sent. Add NULL chunk to indicate this.
             strcpy(&conn->priv.sendBuff[conn->priv.sendBuffLen], "0\r\n\r\n");
@@ -427,60 +992,85 @@ void ICACHE_FLASH_ATTR httpdFlushSendBuffer(HttpdInstance *pInstance, HttpdConnD
             ESP_LOGE(TAG, "sendBuff full");
         }
     }
-    if (conn->priv.sendBuffLen!=0)
+    if (conn->priv.sendBuffPos < conn->priv.sendBuffLen || conn->priv.sendRefCount > 0)
     {
-        r = httpdPlatSendData(pInstance, conn, conn->priv.sendBuff, conn->priv.sendBuffLen);
-        if (r != conn->priv.sendBuffLen) {
-#ifdef CONFIG_ESPHTTPD_BACKLOG_SUPPORT
-            //Can't send this for some reason. Dump packet in backlog, we can send it later.
-            if (conn->priv.sendBacklogSize+conn->priv.sendBuffLen>HTTPD_MAX_BACKLOG_SIZE) {
-                ESP_LOGE(TAG, "Backlog: Exceeded max backlog size, dropped %d bytes", conn->priv.sendBuffLen);
-                conn->priv.sendBuffLen=0;
-                return;
-            }
-            HttpSendBacklogItem *i=malloc(sizeof(HttpSendBacklogItem)+conn->priv.sendBuffLen);
-            if (i==NULL) {
-                ESP_LOGE(TAG, "Backlog: malloc failed");
-                return;
+        //Gather the buffered data and the buffers queued by reference in between, in order
+        struct iovec iov[HTTPD_MAX_SEND_REFS*2+1];
+        int iovcnt=0;
+        int pos=conn->priv.sendBuffPos;
+        for (int i=0; i<conn->priv.sendRefCount; i++) {
+            HttpdSendRef *ref=&conn->priv.sendRefs[i];
+            if (ref->buffEnd > pos) {
+                iov[iovcnt].iov_base=conn->priv.sendBuff+pos;
+                iov[iovcnt++].iov_len=ref->buffEnd-pos;
+                pos=ref->buffEnd;
             }
-            memcpy(i->data, conn->priv.sendBuff, conn->priv.sendBuffLen);
-            i->len=conn->priv.sendBuffLen;
-            i->next=NULL;
-            if (conn->priv.sendBacklog==NULL) {
-                conn->priv.sendBacklog=i;
+            iov[iovcnt].iov_base=(void *)ref->data;
+            iov[iovcnt++].iov_len=ref->len;
+        }
+        if (conn->priv.sendBuffLen > pos) {
+            iov[iovcnt].iov_base=conn->priv.sendBuff+pos;
+            iov[iovcnt++].iov_len=conn->priv.sendBuffLen-pos;
+        }
+
+        r = httpdPlatSendDataV(pInstance, conn, iov, iovcnt);
+        if (r < 0) {
+            ESP_LOGE(TAG, "send failed, dropping queued data");
+            conn->priv.sendBuffPos = conn->priv.sendBuffLen;
+            while (conn->priv.sendRefCount>0) httpdSendRefPop(conn);
+            httpdPlatDisconnect(conn);
+        } else {
+            //Whatever the socket didn't take is written when it becomes writable again
+            httpdSendConsume(conn, r);
+        }
+    }
+
+    //Nothing left to send, give the buffer back until the next httpdSend()
+    if (conn->priv.sendBuffPos >= conn->priv.sendBuffLen && conn->priv.sendRefCount == 0) {
+        httpdSendBuffRelease(conn);
+
+        //Everything in front of the queued file has been written, hand the file to the socket
+        if (conn->priv.sendFdLeft>0 && conn->priv.flags&HFL_SENDFILE) {
+            r = httpdPlatSendFile(pInstance, conn, conn->priv.sendFd, &conn->priv.sendFdOffset, conn->priv.sendFdLeft);
+            if (r < 0) {
+                ESP_LOGE(TAG, "sendfile failed, dropping %u bytes", (unsigned)conn->priv.sendFdLeft);
+                conn->priv.sendFdLeft=0;
+                httpdPlatDisconnect(conn);
             } else {
-                HttpSendBacklogItem *e=conn->priv.sendBacklog;
-                while (e->next!=NULL) e=e->next;
-                e->next=i;
+                conn->priv.sendFdLeft-=r;
             }
-            conn->priv.sendBacklogSize+=conn->priv.sendBuffLen;
-#else
-            ESP_LOGE(TAG, "send buf tried to write %d bytes, wrote %d", conn->priv.sendBuffLen, r);
-#endif
         }
-        conn->priv.sendBuffLen=0;
     }
 }
 
 void ICACHE_FLASH_ATTR httpdCgiIsDone(HttpdInstance *pInstance, HttpdConnData *conn) {
     conn->cgi=NULL; //no need to call this anymore
 
-    if (conn->priv.flags&HFL_CHUNKED)
+    //The request has been handled, the head and the memory of the request aren't needed anymore
+    httpdHeadRelease(conn);
+    httpdPostBuffRelease(conn);
+    httpdArenaRelease(conn);
+
+    //The rest of a body the cgi didn't wait for can't be told apart from the next request
+    if ((conn->priv.flags&(HFL_CHUNKED|HFL_KEEPALIVE)) && conn->post.received>=conn->post.len)
     {
         ESP_LOGD(TAG, "cleaning up");
         httpdFlushSendBuffer(pInstance, conn);
-        //Note: Do not clean up sendBacklog, it may still contain data at this point.
-        conn->priv.headPos=0;
+        //Note: The send buffer may still hold data waiting for the socket at this point.
         conn->post.len=-1;
-        conn->priv.flags=0;
-        if (conn->post.buff) free(conn->post.buff);
-        conn->post.buff=NULL;
+        conn->priv.flags=HFL_REUSED;
         conn->post.buffLen=0;
         conn->post.received=0;
         conn->hostName=NULL;
     } else {
         //Cannot re-use this connection. Mark to get it killed after all data is sent.
+        //The rest of a chunked body isn't decoded anymore.
+        conn->priv.flags&=~HFL_CHUNKEDBODY;
         conn->priv.flags|=HFL_DISCONAFTERSENT;
+        //Queue the end of a chunked response now, the flushes done while the rest of the
+        //body comes in mustn't add it again.
+        httpdFlushSendBuffer(pInstance, conn);
+        conn->priv.flags&=~(HFL_CHUNKED|HFL_SENDINGBODY);
     }
 }
 
@@ -490,31 +1080,21 @@ CallbackStatus ICACHE_FLASH_ATTR httpdSentCb(HttpdInstance *pInstance, HttpdConn
     return httpdContinue(pInstance, pConn);
 }
 
+static CallbackStatus httpdPipelineResume(HttpdInstance *pInstance, HttpdConnData *conn);
+
 //Can be called after a CGI function has returned HTTPD_CGI_MORE to
 //resume handling an open connection asynchronously
 CallbackStatus ICACHE_FLASH_ATTR httpdContinue(HttpdInstance *pInstance, HttpdConnData * conn) {
     int r;
-    httpdPlatLock(pInstance);
+    httpdPlatConnLock(conn);
     CallbackStatus status = CallbackSuccess;
 
-#ifdef CONFIG_ESPHTTPD_BACKLOG_SUPPORT
-    if (conn->priv.sendBacklog!=NULL) {
-        //We have some backlog to send first.
-        HttpSendBacklogItem *next=conn->priv.sendBacklog->next;
-        int bytesWritten = httpdPlatSendData(pInstance, conn->conn, conn->priv.sendBacklog->data, conn->priv.sendBacklog->len);
-        if(bytesWritten != conn->priv.sendBacklog->len)
-        {
-            ESP_LOGE(TAG, "tried to write %d bytes, wrote %d", conn->priv.sendBacklog->len, bytesWritten);
-        }
-        conn->priv.sendBacklogSize-=conn->priv.sendBacklog->len;
-        free(conn->priv.sendBacklog);
-        conn->priv.sendBacklog=next;
-        httpdPlatUnlock(pInstance);
-        return CallbackSuccess;
-    }
-#endif
-
-    if (conn->priv.flags & HFL_DISCONAFTERSENT) { //Marked for destruction?
+    if (conn->priv.sendBuffPos < conn->priv.sendBuffLen || conn->priv.sendRefCount > 0 ||
+        conn->priv.sendFdLeft > 0) {
+        //The socket didn't take all data of the last flush or a file is being sent. Write the
+        //rest first, the cgi is called again once everything has been sent.
+        httpdFlushSendBuffer(pInstance, conn);
+    } else if (conn->priv.flags & HFL_DISCONAFTERSENT) { //Marked for destruction?
         ESP_LOGD(TAG, "closing");
         httpdPlatDisconnect(conn);
         status = CallbackSuccess;
@@ -527,8 +1107,6 @@ CallbackStatus ICACHE_FLASH_ATTR httpdContinue(HttpdInstance *pInstance, HttpdCo
             status = CallbackSuccess;
         } else
         {
-            conn->priv.sendBuffLen = 0;
-
             r = conn->cgi(conn); //Execute cgi fn.
 
             if (r==HTTPD_CGI_DONE)
@@ -543,20 +1121,41 @@ CallbackStatus ICACHE_FLASH_ATTR httpdContinue(HttpdInstance *pInstance, HttpdCo
                 (r == HTTPD_CGI_AUTHENTICATED))
             {
                 httpdCgiIsDone(pInstance, conn);
+                //Go on with the requests the client pipelined behind this one
+                status = httpdPipelineResume(pInstance, conn);
             }
 
             httpdFlushSendBuffer(pInstance, conn);
+            if (r==HTTPD_CGI_MORE && HTTPD_DROPS_BODY(conn) &&
+                conn->priv.sendBuffPos>=conn->priv.sendBuffLen && conn->priv.sendRefCount==0)
+            {
+                //The body the cgi produced was dropped, no sent callback will call it again
+                httpdPlatContinueAsync(pInstance, conn);
+            }
         }
     }
 
-    httpdPlatUnlock(pInstance);
+    httpdPlatConnUnlock(conn);
     return status;
 }
 
+void ICACHE_FLASH_ATTR httpdContinueAsync(HttpdInstance *pInstance, HttpdConnData *conn) {
+    httpdPlatContinueAsync(pInstance, conn);
+}
+
 //This is called when the headers have been received and the connection is ready to send
 //the result headers and data.
 //We need to find the CGI function to call, call it, and dependent on what it returns either
 //find the next cgi function, wait till the cgi data is sent or close up the connection.
+//See if a route of the built-in URL table applies to url.
+static bool ICACHE_FLASH_ATTR httpdRouteMatches(const char *route, const char *url) {
+    //See if there's a literal match
+    if (strcmp(route, url)==0) return true;
+    // See if there's a wildcard match, if the route entry ends in '*'
+    // and everything up to the '*' is a match
+    return route[strlen(route)-1]=='*' && strncmp(route, url, strlen(route)-1)==0;
+}
+
 static void ICACHE_FLASH_ATTR httpdProcessRequest(HttpdInstance *pInstance, HttpdConnData *conn) {
     int r;
     int i=0;
@@ -571,7 +1170,7 @@ static void ICACHE_FLASH_ATTR httpdProcessRequest(HttpdInstance *pInstance, Http
     if (conn->requestType == HTTPD_METHOD_OPTIONS)
     {
         httpdStartResponse(conn, 200);
-        httpdHeader(conn, "Access-Control-Allow-Headers", conn->priv.corsToken);
+        httpdHeader(conn, "Access-Control-Allow-Headers", conn->priv.corsToken ? conn->priv.corsToken : "");
         httpdEndHeaders(conn);
         httpdCgiIsDone(pInstance, conn);
 
@@ -586,22 +1185,9 @@ static void ICACHE_FLASH_ATTR httpdProcessRequest(HttpdInstance *pInstance, Http
         //Look up URL in the built-in URL table.
         while (pInstance->builtInUrls[i].url!=NULL) {
             const HttpdBuiltInUrl *pUrl = &(pInstance->builtInUrls[i]);
-            bool match = false;
             const char* route = pUrl->url;
 
-            //See if there's a literal match
-            if (strcmp(route, conn->url)==0)
-            {
-                match = true;
-            } else if(route[strlen(route)-1]=='*' &&
-                        strncmp(route, conn->url, strlen(route)-1)==0)
-            {
-                // See if there's a wildcard match, if the route entry ends in '*'
-                // and everything up to the '*' is a match
-                match = true;
-            }
-
-            if (match) {
+            if (httpdRouteMatches(route, conn->url)) {
                 ESP_LOGD(TAG, "Is url index %d", i);
                 conn->route=route;
                 conn->cgiData=NULL;
@@ -628,6 +1214,9 @@ static void ICACHE_FLASH_ATTR httpdProcessRequest(HttpdInstance *pInstance, Http
                 //Seems the CGI is planning to do some long-term communications with the socket.
                 //Disable the timeout on it, so we won't run into that.
                 httpdPlatDisableTimeout(conn);
+                //The request head isn't used after the upgrade, don't keep it around for
+                //the lifetime of the connection.
+                httpdHeadRelease(conn);
             }
             httpdFlushSendBuffer(pInstance, conn);
             break;
@@ -643,6 +1232,78 @@ static void ICACHE_FLASH_ATTR httpdProcessRequest(HttpdInstance *pInstance, Http
     }
 }
 
+//Refuse a request before its body has been received. The connection is closed after the
+//response, the body isn't read.
+static void ICACHE_FLASH_ATTR httpdRejectRequest(HttpdInstance *pInstance, HttpdConnData *conn, int code, const char *msg) {
+    ESP_LOGD(TAG, "Refusing %s: %d", conn->url, code);
+    httpdSetTransferMode(conn, HTTPD_TRANSFER_CLOSE);
+    httpdStartResponse(conn, code);
+    httpdEndHeaders(conn);
+    httpdSend(conn, msg, -1);
+    httpdCgiIsDone(pInstance, conn);
+}
+
+//Decide about a request with a body once its head is complete: refuse it when the body is too
+//long, when no route takes it or when a route checking the head refuses it. Tell a client that
+//waits for it to send the body otherwise, and have it streamed when the route that takes it
+//wants that. Returns false when the request was refused.
+static bool ICACHE_FLASH_ATTR httpdCheckRequest(HttpdInstance *pInstance, HttpdConnData *conn) {
+    const HttpdBuiltInUrl *pUrl;
+    const char *expect;
+    bool matched=false;
+    int transferFlags;
+    int r;
+
+    if (conn->url==NULL) return true;
+
+    if (pInstance->maxBodyLen>0 && conn->post.len>pInstance->maxBodyLen && !(conn->priv.flags&HFL_CHUNKEDBODY)) {
+        httpdRejectRequest(pInstance, conn, 413, "413 Request body too large.");
+        return false;
+    }
+
+    for (pUrl=pInstance->builtInUrls; pUrl->url!=NULL; pUrl++) {
+        if (!httpdRouteMatches(pUrl->url, conn->url)) continue;
+        matched=true;
+        //The other routes are only called once the body arrives
+        if (!(pUrl->flags&HTTPD_ROUTE_FLAG_CHECK_HEAD)) {
+            if (pUrl->flags&HTTPD_ROUTE_FLAG_STREAM_BODY) conn->priv.flags|=HFL_STREAMBODY;
+            break;
+        }
+
+        conn->route=pUrl->url;
+        conn->cgiData=NULL;
+        conn->cgi=pUrl->cgiCb;
+        conn->cgiArg=pUrl->cgiArg;
+        conn->cgiArg2=pUrl->cgiArg2;
+        //A refusal is answered before the body is read, the connection is closed after it
+        transferFlags=conn->priv.flags&(HFL_CHUNKED|HFL_NOCONNECTIONSTR);
+        httpdSetTransferMode(conn, HTTPD_TRANSFER_CLOSE);
+        r=conn->cgi(conn);
+        if (r==HTTPD_CGI_DONE) {
+            //Refused, the cgi has sent its response
+            httpdCgiIsDone(pInstance, conn);
+            return false;
+        }
+        if (!(conn->priv.flags&HFL_SENDINGBODY)) conn->priv.flags|=transferFlags;
+        if (r==HTTPD_CGI_MORE) {
+            //The cgi takes the body
+            if (pUrl->flags&HTTPD_ROUTE_FLAG_STREAM_BODY) conn->priv.flags|=HFL_STREAMBODY;
+            break;
+        }
+        conn->cgi=NULL;
+    }
+    if (!matched) {
+        httpdRejectRequest(pInstance, conn, 404, "404 File not found.");
+        return false;
+    }
+
+    if ((conn->priv.flags&HFL_HTTP11) && httpdGetHeaderView(conn, "Expect", &expect, NULL) &&
+            strcasecmp(expect, "100-continue")==0) {
+        httpdSend(conn, "HTTP/1.1 100 Continue\r\n\r\n", -1);
+    }
+    return true;
+}
+
 //Parse a line of header data and modify the connection data accordingly.
 static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData *conn) {
     int i;
@@ -671,6 +1332,9 @@ static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData
     } else if (strncmp(h, "DELETE ", 7)==0) {
         conn->requestType = HTTPD_METHOD_DELETE;
         firstLine=1;
+    } else if (strncmp(h, "HEAD ", 5)==0) {
+        conn->requestType = HTTPD_METHOD_HEAD;
+        firstLine=1;
     }
     if (firstLine) {
         char *e;
@@ -704,14 +1368,9 @@ static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData
         }
 
 #ifdef CONFIG_ESPHTTPD_SANITIZE_URLS
-        // Remove multiple repeated slashes in URL path.
-        while((e = strstr(conn->url, "//")) != NULL){
-            // Move string starting at second slash one place to the left.
-            // Use strlen() on the first slash so the '\0' will be copied too.
-            ESP_LOGD(TAG, "Cleaning up URL path: %s", conn->url);
-            memmove(e, e + 1, strlen(e));
-            ESP_LOGD(TAG, "Cleaned URL path: %s", conn->url);
-        }
+        // Decode the URL path and remove repeated slashes and dot segments from it.
+        httpdNormalizePath(conn->url);
+        ESP_LOGD(TAG, "Cleaned URL path: %s", conn->url);
 #endif // CONFIG_ESPHTTPD_SANITIZE_URLS
     } else if (strncasecmp(h, "Connection:", 11)==0) {
         i=11;
@@ -722,26 +1381,14 @@ static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData
         i=15;
         //Skip trailing spaces
         while (h[i]==' ') i++;
-        //Get POST data length
-        conn->post.len=atoi(h+i);
-
-        // Allocate the buffer
-        if (conn->post.len > HTTPD_MAX_POST_LEN) {
-            // we'll stream this in in chunks
-            conn->post.buffSize = HTTPD_MAX_POST_LEN;
-        } else {
-            conn->post.buffSize = conn->post.len;
-        }
-
-        ESP_LOGD(TAG, "Mallocced buffer for %d + 1 bytes of post data", conn->post.buffSize);
-        int bufferSize = conn->post.buffSize + 1;
-        conn->post.buff=(char*)malloc(bufferSize);
-        if (conn->post.buff==NULL) {
-            ESP_LOGE(TAG, "malloc failed %d bytes", bufferSize);
-            status = CallbackErrorMemory;
-        } else
-        {
-            conn->post.buffLen=0;
+        //Get POST data length. post.len still says the head is being received, it's set once
+        //the head is complete.
+        conn->priv.bodyLen=atoi(h+i);
+        if (conn->priv.bodyLen<0) conn->priv.bodyLen=0;
+    } else if (strncasecmp(h, "Transfer-Encoding:", 18)==0) {
+        //The request body comes in chunks, its length isn't known up front
+        for (i=18; h[i]!=0; i++) {
+            if (strncasecmp(&h[i], "chunked", 7)==0) conn->priv.flags|=HFL_CHUNKEDBODY;
         }
     } else if (strncasecmp(h, "Content-Type: ", 14)==0) {
         if (strstr(h, "multipart/form-data")) {
@@ -757,14 +1404,15 @@ static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData
     }
 #ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
     else if (strncmp(h, "Access-Control-Request-Headers: ", 32)==0) {
-        // CORS token must be repeated in the response, copy it into
-        // the connection token storage
+        // CORS token must be repeated in the response, keep a pointer to it
         ESP_LOGD(TAG, "CORS preflight request");
 
-        strncpy(conn->priv.corsToken, h+strlen("Access-Control-Request-Headers: "), MAX_CORS_TOKEN_LEN);
+        conn->priv.corsToken = h+strlen("Access-Control-Request-Headers: ");
 
-        // ensure null termination of the token
-        conn->priv.corsToken[MAX_CORS_TOKEN_LEN-1] = 0;
+        // limit the length of the token
+        if (strlen(conn->priv.corsToken) >= MAX_CORS_TOKEN_LEN) {
+            conn->priv.corsToken[MAX_CORS_TOKEN_LEN-1] = 0;
+        }
     }
 #endif
 
@@ -775,9 +1423,9 @@ static CallbackStatus ICACHE_FLASH_ATTR httpdParseHeader(char *h, HttpdConnData
 //ToDo: Also make httpdRecvCb/httpdContinue use these?
 CallbackStatus ICACHE_FLASH_ATTR httpdConnSendStart(HttpdInstance *pInstance, HttpdConnData *conn) {
     CallbackStatus status;
-    httpdPlatLock(pInstance);
+    httpdPlatConnLock(conn);
 
-    conn->priv.sendBuffLen=0;
+    // NOTE: data still waiting for the socket stays in the send buffer, new data is appended
     status = CallbackSuccess;
 
     return status;
@@ -786,20 +1434,233 @@ CallbackStatus ICACHE_FLASH_ATTR httpdConnSendStart(HttpdInstance *pInstance, Ht
 //Finish the live-ness of a connection. Always call this after httpdConnStart
 void ICACHE_FLASH_ATTR httpdConnSendFinish(HttpdInstance *pInstance, HttpdConnData *conn) {
     httpdFlushSendBuffer(pInstance, conn);
-    httpdPlatUnlock(pInstance);
+    httpdPlatConnUnlock(conn);
 }
 
-//Callback called when there's data available on a socket.
-CallbackStatus ICACHE_FLASH_ATTR httpdRecvCb(HttpdInstance *pInstance, HttpdConnData *conn, char *data, unsigned short len) {
-    int x, r;
-    char *p, *e;
-    CallbackStatus status = CallbackSuccess;
-    httpdPlatLock(pInstance);
+//Receive bytes of the request head. They're appended to the head buffer in one go and each line
+//is parsed as soon as its end has arrived, so no byte of the head is looked at twice. Returns the
+//number of bytes of data that belong to the head or -1 if it doesn't fit. Once the empty line
+//ending the head has been received, conn->post.len is set to the length of the request body.
+static int ICACHE_FLASH_ATTR httpdRecvHead(HttpdConnData *conn, const char *data, int len) {
+    int used=0;
+
+    while (used<len && conn->post.len<0) {
+        const char *nl=memchr(data+used, '\n', len-used);
+        int n=(nl!=NULL)?(nl-(data+used))+1:len-used;
+
+        //Make room for the bytes up to the end of the line, plus the null terminator
+        //ToDo: return http error code 431 (request header too long) if this fails
+        while (conn->priv.headPos+n >= conn->priv.headSize) {
+            if (!httpdHeadGrow(conn)) {
+                ESP_LOGE(TAG, "request too long!");
+                return -1;
+            }
+        }
+        memcpy(&conn->priv.head[conn->priv.headPos], data+used, n);
+        conn->priv.headPos+=n;
+        // always null terminate
+        conn->priv.head[conn->priv.headPos]=0;
+        used+=n;
+        if (nl==NULL) break; //The rest of the line is still to come
+
+        //Zero-terminate the line. Compatibility with clients that send \n only: the \r is optional.
+        char *line=&conn->priv.head[conn->priv.headLine];
+        char *e=&conn->priv.head[conn->priv.headPos-1];
+        if (e>line && e[-1]=='\r') e--;
+        *e=0;
+        conn->priv.headLine=conn->priv.headPos;
+
+        if (e!=line) {
+            if (line!=conn->priv.head) httpdIndexHeader(conn, line, e);
+            httpdParseHeader(line, conn);
+        } else if (line==conn->priv.head) {
+            //Empty line in front of the request line, eg. the end of the previous POST body
+            conn->priv.headPos=0;
+            conn->priv.headLine=0;
+        } else {
+            //Empty line: the head is complete.
+            if (conn->priv.flags&HFL_CHUNKEDBODY) {
+                //Until the last chunk has been received
+                conn->post.len=INT_MAX;
+                conn->priv.chunkState=HTTPD_CHUNK_SIZE_START;
+                conn->priv.chunkLeft=0;
+            } else {
+                conn->post.len=conn->priv.bodyLen;
+            }
+            conn->priv.bodyLen=0;
+        }
+    }
+    return used;
+}
 
-    conn->priv.sendBuffLen=0;
-#ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
-    conn->priv.corsToken[0] = 0;
-#endif
+//Allocate the buffer POST data is collected in before it's handed to the cgi, from the connection arena.
+static bool ICACHE_FLASH_ATTR httpdPostBuffAcquire(HttpdConnData *conn) {
+    if (conn->post.len > HTTPD_MAX_POST_LEN) {
+        // we'll stream this in in chunks
+        conn->post.buffSize = HTTPD_MAX_POST_LEN;
+    } else {
+        conn->post.buffSize = conn->post.len;
+    }
+
+    ESP_LOGD(TAG, "Buffer for %d + 1 bytes of post data", conn->post.buffSize);
+    conn->post.buff=(char*)httpdArenaAlloc(conn, conn->post.buffSize + 1);
+    if (conn->post.buff==NULL) return false;
+    conn->post.buffLen=0;
+    return true;
+}
+
+//Hand the POST data in post.buff to the cgi.
+static void ICACHE_FLASH_ATTR httpdPostChunk(HttpdInstance *pInstance, HttpdConnData *conn) {
+    int r;
+
+    //Process the data
+    if (conn->cgi) {
+        r=conn->cgi(conn);
+        if (conn->priv.flags&HFL_STREAMBODY) conn->post.buff=NULL; //Only valid during the call
+        if (r==HTTPD_CGI_DONE) {
+            httpdCgiIsDone(pInstance, conn);
+        }
+    } else {
+        //No CGI fn set yet: probably first call. Allow httpdProcessRequest to choose CGI and
+        //call it the first time.
+        httpdProcessRequest(pInstance, conn);
+        if (conn->priv.flags&HFL_STREAMBODY) conn->post.buff=NULL;
+    }
+    conn->post.buffLen = 0;
+}
+
+//Hand up to n bytes of the request body to the cgi. A streamed body is handed over right where
+//it was received, otherwise the bytes are collected in the POST buffer first. Returns the number
+//of bytes used.
+static int ICACHE_FLASH_ATTR httpdPostData(HttpdInstance *pInstance, HttpdConnData *conn, char *data, int n) {
+    if (conn->priv.flags&HFL_STREAMBODY) {
+        conn->post.buff=data;
+        conn->post.buffLen=n;
+        conn->post.received+=n;
+        httpdPostChunk(pInstance, conn);
+        return n;
+    }
+
+    if (n>conn->post.buffSize-conn->post.buffLen) n=conn->post.buffSize-conn->post.buffLen;
+    memcpy(&conn->post.buff[conn->post.buffLen], data, n);
+    conn->post.buffLen+=n;
+    conn->post.received+=n;
+    conn->hostName=NULL;
+    if (conn->post.buffLen >= conn->post.buffSize || conn->post.received == conn->post.len) {
+        //Received a chunk of post data
+        conn->post.buff[conn->post.buffLen]=0; //zero-terminate, in case the cgi handler knows it can use strings
+        httpdPostChunk(pInstance, conn);
+    }
+    return n;
+}
+
+static int ICACHE_FLASH_ATTR httpdHexDigit(char c) {
+    if (c>='0' && c<='9') return c-'0';
+    if (c>='a' && c<='f') return c-'a'+10;
+    if (c>='A' && c<='F') return c-'A'+10;
+    return -1;
+}
+
+//Decode bytes of a chunked request body. The chunk data is handed to the cgi like a body with a
+//Content-Length, once the last chunk is in post.len is set to the total length. Returns the
+//number of bytes used, or -1 if the body isn't validly encoded.
+static int ICACHE_FLASH_ATTR httpdRecvChunked(HttpdInstance *pInstance, HttpdConnData *conn, char *data, int len) {
+    int used=0;
+
+    //Stop when the cgi is done with the request, whatever is left isn't part of this body anymore.
+    //A cgi that is done before the whole body is in has released the POST buffer and the head.
+    while (used<len && (conn->priv.flags&HFL_CHUNKEDBODY) && !(conn->priv.flags&HFL_DISCONAFTERSENT)
+            && conn->post.received<conn->post.len) {
+        char c=data[used];
+        int d;
+
+        switch (conn->priv.chunkState) {
+        case HTTPD_CHUNK_SIZE_START:
+        case HTTPD_CHUNK_SIZE:
+            d=httpdHexDigit(c);
+            if (d>=0) {
+                if (conn->priv.chunkLeft > (INT_MAX>>4)) {
+                    ESP_LOGE(TAG, "request body chunk too large");
+                    return -1;
+                }
+                conn->priv.chunkLeft=conn->priv.chunkLeft*16+d;
+                conn->priv.chunkState=HTTPD_CHUNK_SIZE;
+            } else if (conn->priv.chunkState==HTTPD_CHUNK_SIZE_START) {
+                ESP_LOGE(TAG, "invalid request body chunk size");
+                return -1;
+            } else if (c=='\n') {
+                conn->priv.chunkState=HTTPD_CHUNK_SIZE_END;
+                break;
+            } else {
+                //Chunk extensions are ignored
+                conn->priv.chunkState=HTTPD_CHUNK_EXT;
+            }
+            used++;
+            break;
+        case HTTPD_CHUNK_EXT:
+            if (c=='\n') {
+                conn->priv.chunkState=HTTPD_CHUNK_SIZE_END;
+                break;
+            }
+            used++;
+            break;
+        case HTTPD_CHUNK_SIZE_END:
+            //At the \n ending the chunk size line
+            if (pInstance->maxBodyLen>0 && conn->priv.chunkLeft>pInstance->maxBodyLen-conn->post.received) {
+                ESP_LOGE(TAG, "request body longer than %d bytes", pInstance->maxBodyLen);
+                return -1;
+            }
+            conn->priv.chunkState=(conn->priv.chunkLeft>0)?HTTPD_CHUNK_DATA:HTTPD_CHUNK_TRAILER;
+            used++;
+            break;
+        case HTTPD_CHUNK_DATA:
+            d=len-used;
+            if (d>conn->priv.chunkLeft) d=conn->priv.chunkLeft;
+            d=httpdPostData(pInstance, conn, data+used, d);
+            conn->priv.chunkLeft-=d;
+            used+=d;
+            if (conn->priv.chunkLeft==0) conn->priv.chunkState=HTTPD_CHUNK_DATA_END;
+            break;
+        case HTTPD_CHUNK_DATA_END:
+            //The CRLF after the chunk data
+            if (c=='\n') {
+                conn->priv.chunkState=HTTPD_CHUNK_SIZE_START;
+            } else if (c!='\r') {
+                ESP_LOGE(TAG, "request body chunk longer than announced");
+                return -1;
+            }
+            used++;
+            break;
+        case HTTPD_CHUNK_TRAILER:
+            //Trailer fields are ignored, an empty line ends the body
+            if (c=='\n') {
+                used++;
+                conn->post.len=conn->post.received;
+                if (conn->priv.flags&HFL_STREAMBODY) {
+                    conn->post.buff=data+used;
+                    conn->post.buffLen=0;
+                } else {
+                    conn->post.buff[conn->post.buffLen]=0;
+                }
+                httpdPostChunk(pInstance, conn);
+                break;
+            }
+            if (c!='\r') conn->priv.chunkState=HTTPD_CHUNK_TRAILER_LINE;
+            used++;
+            break;
+        case HTTPD_CHUNK_TRAILER_LINE:
+            if (c=='\n') conn->priv.chunkState=HTTPD_CHUNK_TRAILER;
+            used++;
+            break;
+        }
+    }
+    return used;
+}
+
+//Handle received bytes. Returns the number of bytes used, which is less than len when the
+//client sent the next request before the current one has been handled.
+static int ICACHE_FLASH_ATTR httpdRecvData(HttpdInstance *pInstance, HttpdConnData *conn, char *data, int len, CallbackStatus *status) {
+    int x, r;
 
     //This is slightly evil/dirty: we abuse conn->post.len as a state variable for where in the http communications we are:
     //<0 (-1): Post len unknown because we're still receiving headers
@@ -807,81 +1668,52 @@ CallbackStatus ICACHE_FLASH_ATTR httpdRecvCb(HttpdInstance *pInstance, HttpdConn
     //>0: Need to receive post data
     //ToDo: See if we can use something more elegant for this.
 
-    for (x=0; x<len; x++)
+    x=0;
+    while (x<len)
     {
-        if (conn->post.len<0) // This byte is a header byte
+        if (conn->post.len<0) // These bytes are header bytes
         {
-            if (data[x]=='\n')
+            if (!httpdHeadAcquire(conn))
             {
-                if(conn->priv.headPos < HTTPD_MAX_HEAD_LEN-1)
-                {
-                    //Compatibility with clients that send \n only: fake a \r in front of this.
-                    if (conn->priv.headPos!=0 && conn->priv.head[conn->priv.headPos-1]!='\r') {
-                        conn->priv.head[conn->priv.headPos++]='\r';
-                    }
-                } else
-                {
-                    ESP_LOGE(TAG, "adding newline request too long");
-                    status = CallbackErrorMemory;
-                    break;
-                }
+                *status = CallbackErrorMemory;
+                break;
             }
 
-            //ToDo: return http error code 431 (request header too long) if this happens
-            if (conn->priv.headPos < HTTPD_MAX_HEAD_LEN-1)
-            {
-                conn->priv.head[conn->priv.headPos++]=data[x];
-            } else
+            r=httpdRecvHead(conn, data+x, len-x);
+            if (r<0)
             {
-                ESP_LOGE(TAG, "request too long!");
-                status = CallbackErrorMemory;
+                *status = CallbackErrorMemory;
                 break;
             }
-
-            // always null terminate
-            conn->priv.head[conn->priv.headPos]=0;
-
-            //Scan for /r/n/r/n. Receiving this indicate the headers end.
-            if (data[x]=='\n' && (char *)strstr(conn->priv.head, "\r\n\r\n")!=NULL) {
-                //Indicate we're done with the headers.
-                conn->post.len=0;
-                //Reset url data
-                conn->url=NULL;
-                //Iterate over all received headers and parse them.
-                p=conn->priv.head;
-                while(p<(&conn->priv.head[conn->priv.headPos-4])) {
-                    e=(char *)strstr(p, "\r\n"); //Find end of header line
-                    if (e==NULL) break;			//Shouldn't happen.
-                    e[0]=0;						//Zero-terminate header
-                    httpdParseHeader(p, conn);	//and parse it.
-                    p=e+2;						//Skip /r/n (now /0/n)
-                }
-                //If we don't need to receive post data, we can send the response now.
-                if (conn->post.len==0) {
-                    httpdProcessRequest(pInstance, conn);
-                }
+            x+=r;
+
+            //If the head is complete and we don't need to receive post data, we can send the response now.
+            if (conn->post.len==0) {
+                httpdProcessRequest(pInstance, conn);
+            } else if (conn->post.len>0 && !httpdCheckRequest(pInstance, conn)) {
+                //Refused, the body is ignored
+            } else if (conn->post.len>0 && !(conn->priv.flags&HFL_STREAMBODY) && !httpdPostBuffAcquire(conn)) {
+                *status = CallbackErrorMemory;
+                break;
             }
-        } else if (conn->post.buff && conn->post.len!=0) {
-            //This byte is a POST byte.
-            conn->post.buff[conn->post.buffLen++]=data[x];
-            conn->post.received++;
-            conn->hostName=NULL;
-            if (conn->post.buffLen >= conn->post.buffSize || conn->post.received == conn->post.len) {
-                //Received a chunk of post data
-                conn->post.buff[conn->post.buffLen]=0; //zero-terminate, in case the cgi handler knows it can use strings
-                //Process the data
-                if (conn->cgi) {
-                    r=conn->cgi(conn);
-                    if (r==HTTPD_CGI_DONE) {
-                        httpdCgiIsDone(pInstance, conn);
-                    }
-                } else {
-                    //No CGI fn set yet: probably first call. Allow httpdProcessRequest to choose CGI and
-                    //call it the first time.
-                    httpdProcessRequest(pInstance, conn);
-                }
-                conn->post.buffLen = 0;
+        } else if (conn->priv.flags&HFL_DISCONAFTERSENT) {
+            //The connection is closed once the response has been sent, nothing more is handled.
+            ESP_LOGD(TAG, "Ignoring %d bytes after the last request", len-x);
+            x=len;
+        } else if ((conn->priv.flags&HFL_CHUNKEDBODY) && conn->post.received<conn->post.len) {
+            //These bytes are part of a chunked request body.
+            r=httpdRecvChunked(pInstance, conn, data+x, len-x);
+            if (r<0)
+            {
+                *status = CallbackError;
+                break;
             }
+            x+=r;
+        } else if ((conn->post.buff || (conn->priv.flags&HFL_STREAMBODY)) && conn->post.received<conn->post.len) {
+            //These bytes are POST bytes.
+            int n=len-x;
+            if (n>conn->post.len-conn->post.received) n=conn->post.len-conn->post.received;
+            x+=httpdPostData(pInstance, conn, data+x, n);
         } else {
             //Let cgi handle data if it registered a recvHdl callback. If not, ignore.
             if (conn->recvHdl) {
@@ -891,16 +1723,74 @@ CallbackStatus ICACHE_FLASH_ATTR httpdRecvCb(HttpdInstance *pInstance, HttpdConn
                     httpdCgiIsDone(pInstance, conn);
                     //We assume the recvhdlr has sent something; we'll kill the sock in the sent callback.
                 }
+                x=len;
                 break; //ignore rest of data, recvhdl has parsed it.
+            } else if (conn->cgi) {
+                //Pipelined request, it's handled once the cgi is done with the current one.
+                break;
             } else {
                 ESP_LOGE(TAG, "Unexpected data from client. %s", data);
-                status = CallbackError;
+                *status = CallbackError;
                 break; // avoid infinite loop
             }
         }
     }
+
+    return x;
+}
+
+//Hold back the bytes of requests the client sent before the current one has been handled.
+static bool ICACHE_FLASH_ATTR httpdPipelineQueue(HttpdConnData *conn, const char *data, int len) {
+    if (conn->priv.pipeLen+len > HTTPD_MAX_PIPELINE_LEN) {
+        ESP_LOGE(TAG, "too much pipelined request data");
+        return false;
+    }
+    char *buff=realloc(conn->priv.pipeBuff, conn->priv.pipeLen+len);
+    if (buff==NULL) {
+        ESP_LOGE(TAG, "no memory for %d bytes of pipelined request data", conn->priv.pipeLen+len);
+        return false;
+    }
+    memcpy(buff+conn->priv.pipeLen, data, len);
+    conn->priv.pipeBuff=buff;
+    conn->priv.pipeLen+=len;
+    return true;
+}
+
+//Handle the requests held back by httpdPipelineQueue() once the current one is done.
+static CallbackStatus ICACHE_FLASH_ATTR httpdPipelineResume(HttpdInstance *pInstance, HttpdConnData *conn) {
+    CallbackStatus status = CallbackSuccess;
+
+    if (conn->priv.pipeLen==0 || conn->cgi!=NULL || (conn->priv.flags&HFL_DISCONAFTERSENT)) return status;
+
+    int used=httpdRecvData(pInstance, conn, conn->priv.pipeBuff, conn->priv.pipeLen, &status);
+    if (used<conn->priv.pipeLen) {
+        memmove(conn->priv.pipeBuff, conn->priv.pipeBuff+used, conn->priv.pipeLen-used);
+        conn->priv.pipeLen-=used;
+    } else {
+        free(conn->priv.pipeBuff);
+        conn->priv.pipeBuff=NULL;
+        conn->priv.pipeLen=0;
+    }
+    return status;
+}
+
+//Callback called when there's data available on a socket.
+CallbackStatus ICACHE_FLASH_ATTR httpdRecvCb(HttpdInstance *pInstance, HttpdConnData *conn, char *data, unsigned short len) {
+    int x;
+    CallbackStatus status = CallbackSuccess;
+    httpdPlatConnLock(conn);
+
+    if (conn->priv.pipeLen>0) {
+        //Earlier requests are still waiting, keep the order
+        x=0;
+    } else {
+        x=httpdRecvData(pInstance, conn, data, len, &status);
+    }
+    if (status==CallbackSuccess && x<len && !httpdPipelineQueue(conn, data+x, len-x)) {
+        status = CallbackErrorMemory;
+    }
     httpdFlushSendBuffer(pInstance, conn);
-    httpdPlatUnlock(pInstance);
+    httpdPlatConnUnlock(conn);
 
     return status;
 }
@@ -908,30 +1798,59 @@ CallbackStatus ICACHE_FLASH_ATTR httpdRecvCb(HttpdInstance *pInstance, HttpdConn
 //The platform layer should ALWAYS call this function, regardless if the connection is closed by the server
 //or by the client.
 CallbackStatus ICACHE_FLASH_ATTR httpdDisconCb(HttpdInstance *pInstance, HttpdConnData *pConn) {
-    httpdPlatLock(pInstance);
+    httpdPlatConnLock(pConn);
 
     ESP_LOGD(TAG, "Socket closed");
     pConn->isConnectionClosed = true;
     if (pConn->cgi) pConn->cgi(pConn); //Execute cgi fn if needed
     httpdRetireConn(pInstance, pConn);
-    httpdPlatUnlock(pInstance);
+    httpdPlatConnUnlock(pConn);
 
     return CallbackSuccess;
 }
 
 
 void ICACHE_FLASH_ATTR httpdConnectCb(HttpdInstance *pInstance, HttpdConnData *pConn) {
-    httpdPlatLock(pInstance);
+    httpdPlatConnLock(pConn);
 
     memset(pConn, 0, sizeof(HttpdConnData));
     pConn->post.len=-1;
+    pConn->priv.instance=pInstance;
 
-    httpdPlatUnlock(pInstance);
+    httpdPlatConnUnlock(pConn);
+}
+
+HttpdTimeoutKind ICACHE_FLASH_ATTR httpdConnTimeoutKind(HttpdConnData *pConn) {
+    HttpdTimeoutKind kind;
+    httpdPlatConnLock(pConn);
+
+    if (pConn->priv.sendBuffPos < pConn->priv.sendBuffLen || pConn->priv.sendRefCount > 0 ||
+        pConn->priv.sendFdLeft > 0) {
+        kind=HTTPD_TIMEOUT_WRITE;
+    } else if (pConn->post.len<0) {
+        //Until the first byte of the next request arrives a re-used connection is idle
+        if (pConn->priv.head==NULL && (pConn->priv.flags&HFL_REUSED)) {
+            kind=HTTPD_TIMEOUT_KEEPALIVE;
+        } else {
+            kind=HTTPD_TIMEOUT_HEADER;
+        }
+    } else if (pConn->post.len>0 && pConn->post.received<pConn->post.len) {
+        kind=HTTPD_TIMEOUT_BODY;
+    } else {
+        kind=HTTPD_TIMEOUT_NONE;
+    }
+
+    httpdPlatConnUnlock(pConn);
+    return kind;
 }
 
 #ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
 void httpdShutdown(HttpdInstance *pInstance)
 {
     httpdPlatShutdown(pInstance);
+
+    httpdPoolDrain(&pInstance->headPool);
+    httpdPoolDrain(&pInstance->sendBuffPool);
+    httpdPoolDrain(&pInstance->arenaPool);
 }
 #endif
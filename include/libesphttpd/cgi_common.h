@@ -3,6 +3,7 @@
 #ifndef CGI_COMMON_H
 #define CGI_COMMON_H
 
+#include <stddef.h>
 #include "libesphttpd/httpd.h"
 #include "cJSON.h"
 
@@ -15,6 +16,42 @@ bool cgiGetArgHexU32(const char *allArgs, const char *argName, uint32_t *pvalue,
 // Parses *allArgs (i.e. connData->getArgs or connData->post.buff) for a string value.  (just a wrapper for httpdFindArg())
 bool cgiGetArgString(const char *allArgs, const char *argName, char *buff, int buffLen);
 
+// Type of the struct member a GET or POST parameter is stored in by cgiBindArgs()
+typedef enum {
+	CGI_ARG_STRING,		// char array, url-decoded and null terminated, truncated to fit
+	CGI_ARG_DEC_S32,	// int32_t from a decimal string
+	CGI_ARG_DEC_U32,	// uint32_t from a decimal string
+	CGI_ARG_HEX_U32,	// uint32_t from a hexadecimal string
+} CgiArgType;
+
+typedef struct {
+	const char *name;
+	CgiArgType type;
+	size_t offset;		// of the member in the struct
+	size_t size;		// of the member
+} CgiArgDef;
+
+// Entry of a CgiArgDef table: the parameter argName is stored in structType.member
+#define CGI_ARG(argName, argType, structType, member) \
+	{ (argName), (argType), offsetof(structType, member), sizeof(((structType *)0)->member) }
+
+/**
+ * Example usage of cgiBindArgs
+ *
+struct scanArgs { uint32_t clear; uint32_t start; };
+static const CgiArgDef scanArgDefs[] = {
+	CGI_ARG("clear", CGI_ARG_DEC_U32, struct scanArgs, clear),
+	CGI_ARG("start", CGI_ARG_DEC_U32, struct scanArgs, start),
+};
+	struct scanArgs args = {0};
+	uint32_t found = cgiBindArgs(connData->getArgs, scanArgDefs, 2, &args);
+	if (found & (1 << 1)) ... // start was given
+ */
+// Parses *allArgs (i.e. connData->getArgs or connData->post.buff) once and stores the parameters named in
+// defs[] in the struct at *out. Returns a bit mask of the defs that were found and converted, bit i for
+// defs[i] (max 32 defs). Members of missing or malformed parameters are left untouched.
+uint32_t cgiBindArgs(const char *allArgs, const CgiArgDef *defs, int defCount, void *out);
+
 
 void cgiJsonResponseHeaders(HttpdConnData *connData);
 void cgiJavascriptResponseHeaders(HttpdConnData *connData);
@@ -35,6 +35,12 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData);
 int ICACHE_FLASH_ATTR cgiWebsocketSend(HttpdInstance *pInstance, Websock *ws, const char *data, int len, int flags);
 void ICACHE_FLASH_ATTR cgiWebsocketClose(HttpdInstance *pInstance, Websock *ws, int reason);
 CgiStatus ICACHE_FLASH_ATTR cgiWebSocketRecv(HttpdInstance *pInstance, HttpdConnData *connData, char *data, int len);
+/**
+ * Send data to all websockets opened on the given url, returns the number of websockets sent to
+ *
+ * May be called from a websocket callback. A target connection that is busy in another server
+ * task isn't waited for, the data is queued and sent by that task.
+ */
 int ICACHE_FLASH_ATTR cgiWebsockBroadcast(HttpdInstance *pInstance, const char *resource, char *data, int len, int flags);
 
 #ifdef __cplusplus
@@ -0,0 +1,83 @@
+#ifndef HTTPD_FORM_H
+#define HTTPD_FORM_H
+
+/**
+ * Streaming application/x-www-form-urlencoded parser
+ *
+ * A form body is fed in the pieces it arrives in, eg. each post.buff a cgi is called with,
+ * and handed to a callback as (name, value fragment) events. Escapes and fields may straddle
+ * the pieces. Memory use doesn't depend on the size of the body or of a value: only the name
+ * of the current field is kept, values are decoded in place in the data fed.
+ */
+
+#include <stdbool.h>
+#include "libesphttpd/httpd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Max length of a field name the parser keeps, longer names are cut off
+#ifndef HTTPD_FORM_MAX_NAME_LEN
+#define HTTPD_FORM_MAX_NAME_LEN	31
+#endif
+
+typedef enum {
+	HTTPD_FORM_VALUE,		// value is a fragment of the value of the field, more follows
+	HTTPD_FORM_END,			// value is the last fragment of the value of the field, may be empty
+} HttpdFormEvent;
+
+typedef struct HttpdFormParser HttpdFormParser;
+
+/**
+ * Called for each fragment of a field value. Fields without value only get HTTPD_FORM_END.
+ *
+ * @param name url-decoded, null terminated field name
+ * @param value url-decoded fragment of the value, NOT null terminated. Only valid during the call.
+ * @return false to stop parsing the form
+ */
+typedef bool (* HttpdFormCb)(HttpdFormParser *parser, HttpdFormEvent event, const char *name,
+								const char *value, int len, void *arg);
+
+struct HttpdFormParser {
+	bool inValue;			// past the '=' of the current field
+	bool failed;			// the callback stopped the parser
+	char esc;				// hex digits of a %-escape seen so far, 0 if not in one
+	unsigned char escVal;
+	int nameLen;
+	char name[HTTPD_FORM_MAX_NAME_LEN + 1];
+	HttpdFormCb cb;
+	void *arg;
+};
+
+void httpdFormInit(HttpdFormParser *parser, HttpdFormCb cb, void *arg);
+
+/**
+ * Parse the next len bytes of the form
+ *
+ * NOTE: data is url-decoded in place.
+ *
+ * @return false if the callback stopped the parser, now or before
+ */
+bool httpdFormFeed(HttpdFormParser *parser, char *data, int len);
+
+/**
+ * End of the form, completes the last field
+ *
+ * @return false if the callback stopped the parser, now or before
+ */
+bool httpdFormFinish(HttpdFormParser *parser);
+
+/**
+ * Parse the POST data a cgi is called with, and finish the form once the whole body has been
+ * received. Works for buffered bodies as well as for ROUTE_CGI_STREAM routes.
+ *
+ * @return false if the callback stopped the parser, now or before
+ */
+bool httpdFormFeedPost(HttpdFormParser *parser, HttpdConnData *conn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
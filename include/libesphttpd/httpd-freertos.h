@@ -1,6 +1,7 @@
 #pragma once
 
 #include "httpd.h"
+#include "httpd-timerwheel.h"
 
 #ifdef FREERTOS
 #ifdef ESP32
@@ -21,6 +22,59 @@
 #include <netinet/in.h>
 #endif
 
+// Default tls session resumption settings, see httpdFreertosSslSetSessionCache() and
+// httpdFreertosSslSetSessionTickets()
+#ifndef CONFIG_ESPHTTPD_SSL_SESSION_CACHE_SIZE
+#define CONFIG_ESPHTTPD_SSL_SESSION_CACHE_SIZE 32
+#endif
+#ifndef CONFIG_ESPHTTPD_SSL_SESSION_TIMEOUT_S
+#define CONFIG_ESPHTTPD_SSL_SESSION_TIMEOUT_S 300
+#endif
+#ifndef CONFIG_ESPHTTPD_SSL_TICKET_KEY_LIFETIME_S
+#define CONFIG_ESPHTTPD_SSL_TICKET_KEY_LIFETIME_S 3600
+#endif
+
+// Default max length of a request body, 0 doesn't limit it. See httpdFreertosSetMaxBodyLen().
+#ifndef CONFIG_ESPHTTPD_MAX_BODY_LEN
+#define CONFIG_ESPHTTPD_MAX_BODY_LEN 0
+#endif
+
+// Default backlog of the listening socket of a server task, 0 uses the number of connections
+// the task serves. See httpdFreertosSetListenBacklog().
+#ifndef CONFIG_ESPHTTPD_LISTEN_BACKLOG
+#define CONFIG_ESPHTTPD_LISTEN_BACKLOG 0
+#endif
+
+// Default connection timeouts in ms, 0 disables the timeout. See httpdFreertosSetTimeout().
+#ifndef CONFIG_ESPHTTPD_HANDSHAKE_TIMEOUT_MS
+#define CONFIG_ESPHTTPD_HANDSHAKE_TIMEOUT_MS 10000
+#endif
+#ifndef CONFIG_ESPHTTPD_HEADER_TIMEOUT_MS
+#define CONFIG_ESPHTTPD_HEADER_TIMEOUT_MS 10000
+#endif
+#ifndef CONFIG_ESPHTTPD_BODY_TIMEOUT_MS
+#define CONFIG_ESPHTTPD_BODY_TIMEOUT_MS 30000
+#endif
+#ifndef CONFIG_ESPHTTPD_KEEPALIVE_TIMEOUT_MS
+#define CONFIG_ESPHTTPD_KEEPALIVE_TIMEOUT_MS 30000
+#endif
+#ifndef CONFIG_ESPHTTPD_WRITE_TIMEOUT_MS
+#define CONFIG_ESPHTTPD_WRITE_TIMEOUT_MS 30000
+#endif
+
+// On Linux the server loop uses epoll by default, define CONFIG_ESPHTTPD_USE_SELECT
+// to fall back to the portable select() loop or CONFIG_ESPHTTPD_USE_IO_URING to use
+// io_uring (Linux 6.0 or later)
+#if defined(linux) && defined(CONFIG_ESPHTTPD_USE_IO_URING)
+#define HTTPD_USE_IO_URING 1
+#elif defined(linux) && !defined(CONFIG_ESPHTTPD_USE_SELECT)
+#define HTTPD_USE_EPOLL 1
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+#include "httpd-uring.h"
+#endif
+
 
 #ifdef linux
     #define PLAT_RETURN void*
@@ -32,6 +86,26 @@
 extern "C" {
 #endif
 
+struct ServerTaskContext;
+
+typedef enum
+{
+	HTTPD_PLAT_CMD_RESUME,		// call httpdContinue() on a connection, see httpdContinueAsync()
+	HTTPD_PLAT_CMD_SHUTDOWN,	// leave the server loop, see httpdShutdown()
+	HTTPD_PLAT_CMD_UPDATE_EVENTS	// submit the io_uring requests a connection needs now
+} HttpdPlatCmdType;
+
+/**
+ * Entry of the command queue of a server task
+ *
+ * Commands are embedded in the object they act on so posting one never allocates.
+ */
+typedef struct HttpdPlatCmd
+{
+	struct HttpdPlatCmd *next;
+	HttpdPlatCmdType type;
+} HttpdPlatCmd;
+
 struct RtosConnType{
 	int fd;
 	int needWriteDoneNotif;
@@ -40,6 +114,44 @@ struct RtosConnType{
 	char ip[4];
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
 	SSL *ssl;
+	bool sslHandshaking;	// SSL_accept() hasn't completed yet, no http state is attached
+	bool ktlsSend;			// the kernel encrypts sent data, see httpdFreertosSslSetKernelTls()
+	bool sslWriteWantsRead;	// SSL_write() waits for data from the peer, the next readable event resumes sending
+#endif
+#ifdef HTTPD_USE_EPOLL
+	uint32_t epollEvents; // events currently registered with the epoll set
+#endif
+#ifdef HTTPD_USE_IO_URING
+	uint8_t uringArmed;		// io_uring requests in flight, the slot is re-used once none is left
+
+	// data copied from the send calls, written by an io_uring send request
+	char *uringSendBuf;
+	int uringSendLen;
+
+	// submits requests for a connection that was sent on from outside of the server task
+	HttpdPlatCmd eventsCmd;
+	int eventsQueued;
+#endif
+
+	// server task that owns this connection
+	struct ServerTaskContext *ctx;
+
+	// deadline of the connection, in the timer wheel of its server task
+	HttpdTimer timeout;
+	HttpdTimeoutKind timeoutKind;	// kind of deadline the timer was armed for
+	bool noTimeout;					// set by httpdPlatDisableTimeout()
+
+	// resume requested with httpdContinueAsync()
+	HttpdPlatCmd resumeCmd;
+	int resumeQueued;				// resumeCmd is in the command queue
+	unsigned int resumeGeneration;	// generation the resume was requested for
+	unsigned int generation;		// incremented each time the connection is closed
+
+	// guards the connection state, see httpdPlatConnLock()
+#ifdef linux
+	pthread_mutex_t connMux;
+#else
+	xQueueHandle connMux;
 #endif
 
 	// server connection data structure
@@ -48,6 +160,18 @@ struct RtosConnType{
 
 #define RECV_BUF_SIZE 2048
 
+#ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
+// Key protecting session tickets, see httpdFreertosSslSetSessionTickets()
+typedef struct
+{
+	unsigned char name[16];		// sent along with the ticket to find the key again
+	unsigned char aesKey[32];
+	unsigned char hmacKey[32];
+	uint64_t createdMs;
+	bool valid;
+} HttpdSslTicketKey;
+#endif
+
 typedef struct
 {
     RtosConnType *rconn;
@@ -56,14 +180,32 @@ typedef struct
     struct sockaddr_in httpListenAddress;
     HttpdFlags httpdFlags;
 
-#ifdef CONFIG_ESPHTTPD_SHUTDOWN_SUPPORT
-	int udpShutdownPort;
+	bool isShutdown;
+
+	// number of server tasks, see httpdFreertosSetWorkerCount()
+	int workerCount;
+
+	// server tasks that are still running
+	int runningWorkers;
+
+#ifndef linux
+	// task waiting in httpdPlatShutdown() for the server tasks to exit, notified by the last one
+	xTaskHandle shutdownWaiter;
 #endif
 
-	bool isShutdown;
+	// server task contexts, allocated by httpdFreertosStart() or the single context passed
+	// to platHttpServerTaskInit()
+	struct ServerTaskContext *workers;
+	bool workersAllocated;
 
-	// storage for data read in the main loop
-	char precvbuf[RECV_BUF_SIZE];
+	// listening socket options, see httpdFreertosSetListenBacklog(), httpdFreertosSetDeferAccept()
+	// and httpdFreertosSetFastOpen()
+	int listenBacklog;
+	int deferAcceptS;
+	int fastOpenQueueLen;
+
+	// connection timeouts in ms, see httpdFreertosSetTimeout()
+	int timeoutMs[HTTPD_TIMEOUT_KIND_COUNT];
 
 #ifdef linux
     pthread_mutex_t httpdMux;
@@ -73,24 +215,96 @@ typedef struct
 
 #ifdef CONFIG_ESPHTTPD_SSL_SUPPORT
     SSL_CTX *ctx;
+
+    // new tickets use the first key, tickets of the previous key are still accepted
+    HttpdSslTicketKey ticketKeys[2];
+    int ticketKeyLifetimeS;
+
+    // completed handshakes, see httpdFreertosSslGetStats()
+    uint32_t sslFullHandshakes;
+    uint32_t sslResumedHandshakes;
 #endif
 
     HttpdInstance httpdInstance;
 } HttpdFreertosInstance;
 
-typedef struct {
+#ifdef HTTPD_USE_EPOLL
+// Max number of events returned by a single epoll_wait() call
+#ifndef HTTPD_EPOLL_MAX_EVENTS
+#define HTTPD_EPOLL_MAX_EVENTS 64
+#endif
+#endif
+
+#ifdef HTTPD_USE_IO_URING
+// Size of the io_uring submission queue of a server task, a full queue is submitted early
+#ifndef HTTPD_URING_ENTRIES
+#define HTTPD_URING_ENTRIES 256
+#endif
+// Max number of completions taken from the completion queue at once
+#ifndef HTTPD_URING_MAX_CQES
+#define HTTPD_URING_MAX_CQES 64
+#endif
+// Receive buffers registered with the kernel per server task, a power of two
+#ifndef CONFIG_ESPHTTPD_IO_URING_RECV_BUFFERS
+#define CONFIG_ESPHTTPD_IO_URING_RECV_BUFFERS 64
+#endif
+// Size of the per connection buffer that holds data until the kernel sent it
+#ifndef CONFIG_ESPHTTPD_IO_URING_SEND_BUF_SIZE
+#define CONFIG_ESPHTTPD_IO_URING_SEND_BUF_SIZE 16384
+#endif
+#endif
+
+typedef struct ServerTaskContext {
     bool shutdown;
     bool listeningForNewConnections;
     char serverStr[20];
     struct timeval *selectTimeoutData;
     HttpdFreertosInstance *pInstance;
     int32 listenFd;
-    int32 udpListenFd;
     int32 remoteFd;
+
+    // commands posted by other threads, a lock-free stack that the server task takes as a whole
+    HttpdPlatCmd *cmdQueue;
+    HttpdPlatCmd shutdownCmd;
+    // eventfd that is readable while commands are queued, -1 where there is no eventfd and
+    // the queue is polled instead
+    int32 wakeFd;
+
+    // slice of the instance rconn array served by this task
+    int connStart;
+    int connCount;
+
+    // storage for data read in the main loop
+    char *precvbuf;
+
+    // connection deadlines, only touched by this task
+    HttpdTimerWheel timers;
+#ifdef HTTPD_USE_EPOLL
+    int timerFd;                // timerfd armed to the next deadline of the wheel
+    uint64_t timerFdDeadline;   // CLOCK_MONOTONIC ms the timerfd is armed to, 0 if disarmed
+#endif
+
+#ifdef linux
+    pthread_t thread;
+#endif
+#ifdef HTTPD_USE_EPOLL
+    int epollFd;
+    int activeConnections;
+#endif
+#ifdef HTTPD_USE_IO_URING
+    HttpdUring ring;
+    pthread_t loopThread;       // the ring may only be used from this thread
+    int activeConnections;      // slots with an open fd or requests in flight
+    bool acceptArmed;           // the accept request is in flight
+    struct sockaddr_in acceptAddr;  // peer address of the connection being accepted
+    socklen_t acceptAddrLen;
+#endif
 } ServerTaskContext;
 
 /**
  * Execute the server task in a loop, internally calls init, process and deinit
+ *
+ * The task serves all connections of the instance passed in pvParameters.
  */
 PLAT_RETURN platHttpServerTask(void *pvParameters);
 
@@ -134,9 +348,85 @@ HttpdInitStatus httpdFreertosInitEx(HttpdFreertosInstance *pInstance,
 typedef enum
 {
 	StartSuccess,
-	StartFailedSslNotConfigured
+	StartFailedSslNotConfigured,
+	StartFailedOutOfMemory,
+	StartFailedIoUringNotSupported	// built with CONFIG_ESPHTTPD_USE_IO_URING, the kernel lacks it
 } HttpdStartStatus;
 
+/**
+ * Set the number of server tasks started by httpdFreertosStart()
+ *
+ * Each worker owns a listening socket bound with SO_REUSEPORT, an equal slice of
+ * the connection buffer and its own receive buffer, the kernel distributes
+ * incoming connections between the workers.
+ *
+ * NOTE: Must be called before httpdFreertosStart(), defaults to 1
+ * NOTE: Only supported on Linux, other platforms always use a single task
+ */
+void httpdFreertosSetWorkerCount(HttpdFreertosInstance *pInstance, int workerCount);
+
+/**
+ * Set the max length of a request body
+ *
+ * Requests announcing a longer body are answered with 413 and the connection is closed without
+ * receiving the body. A chunked body that turns out to be longer closes the connection.
+ *
+ * @param len max number of body bytes, 0 doesn't limit the length
+ *
+ * NOTE: Defaults to CONFIG_ESPHTTPD_MAX_BODY_LEN
+ */
+void httpdFreertosSetMaxBodyLen(HttpdFreertosInstance *pInstance, int len);
+
+/**
+ * Set the backlog of the listening socket of each server task
+ *
+ * Connections that arrive while all connection slots are in use wait in the backlog, a burst
+ * of connections that doesn't fit is dropped by the network stack.
+ *
+ * @param backlog max number of pending connections, 0 uses the number of connections the
+ *                server task serves
+ *
+ * NOTE: Must be called before httpdFreertosStart(), defaults to CONFIG_ESPHTTPD_LISTEN_BACKLOG
+ */
+void httpdFreertosSetListenBacklog(HttpdFreertosInstance *pInstance, int backlog);
+
+/**
+ * Only accept connections once the client sent data (TCP_DEFER_ACCEPT)
+ *
+ * Saves waking up the server task for connections that don't send a request yet.
+ *
+ * @param timeoutS time the kernel holds back a connection without data, 0 disables
+ *
+ * NOTE: Must be called before httpdFreertosStart(), disabled by default
+ * NOTE: Only supported on Linux
+ */
+void httpdFreertosSetDeferAccept(HttpdFreertosInstance *pInstance, int timeoutS);
+
+/**
+ * Enable TCP fast open on the listening sockets (TCP_FASTOPEN)
+ *
+ * Clients that connected before can send their request along with the SYN.
+ *
+ * @param queueLen max number of pending fast open connections, 0 disables
+ *
+ * NOTE: Must be called before httpdFreertosStart(), disabled by default
+ * NOTE: Only supported on Linux, the server side has to be enabled in net.ipv4.tcp_fastopen
+ */
+void httpdFreertosSetFastOpen(HttpdFreertosInstance *pInstance, int queueLen);
+
+/**
+ * Set the timeout of a kind of connection deadline
+ *
+ * A connection that doesn't make progress within the timeout is closed, eg. a client that
+ * doesn't complete its request head or doesn't read the response. Websocket connections
+ * aren't subject to timeouts.
+ *
+ * @param timeoutMs timeout in ms, 0 disables timeouts of this kind
+ *
+ * NOTE: Must be called before httpdFreertosStart(), defaults to CONFIG_ESPHTTPD_*_TIMEOUT_MS
+ */
+void httpdFreertosSetTimeout(HttpdFreertosInstance *pInstance, HttpdTimeoutKind kind, int timeoutMs);
+
 /**
  * Call to start the server
  */
@@ -186,6 +476,58 @@ void httpdFreertosSslSetClientValidation(HttpdFreertosInstance *pInstance,
  */
 void httpdFreertosSslAddClientCertificate(HttpdFreertosInstance *pInstance,
                                           const void *certificate, size_t certificate_size);
+
+/**
+ * Configure the server side tls session cache
+ *
+ * Clients that reconnect with the id of a cached session skip the full handshake.
+ *
+ * @param cacheSize max number of cached sessions, 0 disables the cache
+ * @param timeoutS lifetime of a session, also applies to sessions resumed from tickets
+ *
+ * NOTE: Call after httpdFreertosSslInit(), defaults to CONFIG_ESPHTTPD_SSL_SESSION_CACHE_SIZE
+ *       and CONFIG_ESPHTTPD_SSL_SESSION_TIMEOUT_S
+ * NOTE: Only supported on Linux
+ */
+void httpdFreertosSslSetSessionCache(HttpdFreertosInstance *pInstance, int cacheSize, int timeoutS);
+
+/**
+ * Enable / disable stateless session tickets
+ *
+ * The session state is encrypted into a ticket that the client presents when it reconnects,
+ * the server doesn't keep anything. A new ticket key is generated every keyLifetimeS seconds,
+ * tickets of the previous key are still accepted and replaced by one of the current key.
+ *
+ * NOTE: Call after httpdFreertosSslInit(), enabled with a key lifetime of
+ *       CONFIG_ESPHTTPD_SSL_TICKET_KEY_LIFETIME_S by default, 0 disables tickets
+ * NOTE: Only supported on Linux
+ */
+void httpdFreertosSslSetSessionTickets(HttpdFreertosInstance *pInstance, bool enable, int keyLifetimeS);
+
+/**
+ * Enable / disable kernel tls offload
+ *
+ * Once the handshake of a connection completes its session keys are handed to the kernel,
+ * which then encrypts the data written to the socket. Responses are written with plain
+ * write() / writev() and static files are sent with sendfile() like on http connections.
+ * Connections for which the kernel doesn't take the keys, eg. because of the cipher, fall
+ * back to SSL_write().
+ *
+ * NOTE: Call after httpdFreertosSslInit(), disabled by default
+ * NOTE: Only supported on Linux, needs openssl built with ktls and the kernel tls module
+ */
+void httpdFreertosSslSetKernelTls(HttpdFreertosInstance *pInstance, bool enable);
+
+typedef struct
+{
+    uint32_t fullHandshakes;
+    uint32_t resumedHandshakes;		// from the session cache or a ticket
+} HttpdSslStats;
+
+/**
+ * Get the handshake counters of the instance, they are reset by httpdFreertosSslInit()
+ */
+void httpdFreertosSslGetStats(HttpdFreertosInstance *pInstance, HttpdSslStats *pStats);
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
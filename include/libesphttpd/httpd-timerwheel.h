@@ -0,0 +1,88 @@
+#ifndef HTTPD_TIMERWHEEL_H
+#define HTTPD_TIMERWHEEL_H
+
+/**
+ * Hierarchical timer wheel
+ *
+ * Arming, re-arming and disarming a timer are O(1), which makes it cheap to keep a
+ * deadline per connection and push it back on every bit of progress. Timers far in the
+ * future sit in the coarser upper levels and are cascaded down as their time comes closer.
+ *
+ * The wheel itself isn't thread-safe, it is owned by a single task (or guarded by its owner)
+ * and only does something when httpdTimerWheelAdvance() is called.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Resolution of the timer wheel, timers expire on a multiple of this
+#ifndef HTTPD_TIMER_WHEEL_TICK_MS
+#define HTTPD_TIMER_WHEEL_TICK_MS	10
+#endif
+
+#define HTTPD_TIMER_WHEEL_BITS		6
+#define HTTPD_TIMER_WHEEL_SLOTS		(1 << HTTPD_TIMER_WHEEL_BITS)
+#define HTTPD_TIMER_WHEEL_LEVELS	4
+
+typedef struct HttpdTimer HttpdTimer;
+typedef void (* HttpdTimerCb)(HttpdTimer *timer, void *arg);
+
+struct HttpdTimer {
+	HttpdTimer *next;
+	HttpdTimer **pprev;		// NULL while the timer isn't armed
+	uint32_t expires;		// tick the timer expires at
+	HttpdTimerCb cb;
+	void *arg;
+};
+
+typedef struct {
+	HttpdTimer *slots[HTTPD_TIMER_WHEEL_LEVELS][HTTPD_TIMER_WHEEL_SLOTS];
+	uint32_t tick;			// next tick to process
+	int count;				// armed timers
+} HttpdTimerWheel;
+
+/**
+ * @param nowMs current time of a monotonic millisecond clock, used for all calls on this wheel
+ */
+void httpdTimerWheelInit(HttpdTimerWheel *wheel, uint64_t nowMs);
+
+void httpdTimerInit(HttpdTimer *timer, HttpdTimerCb cb, void *arg);
+
+/**
+ * (Re-)arm timer to expire delayMs after nowMs
+ */
+void httpdTimerArm(HttpdTimerWheel *wheel, HttpdTimer *timer, uint64_t nowMs, uint32_t delayMs);
+
+void httpdTimerDisarm(HttpdTimerWheel *wheel, HttpdTimer *timer);
+
+static inline bool httpdTimerIsArmed(const HttpdTimer *timer) {
+	return timer->pprev != NULL;
+}
+
+/**
+ * Run the callbacks of all timers that expired up to nowMs
+ *
+ * A timer is disarmed before its callback is called, the callback may arm or disarm any
+ * timer of the wheel, including itself.
+ */
+void httpdTimerWheelAdvance(HttpdTimerWheel *wheel, uint64_t nowMs);
+
+/**
+ * Time until httpdTimerWheelAdvance() has to be called next
+ *
+ * May be earlier than the first timer expires, when timers of the upper levels have to be
+ * cascaded down.
+ *
+ * @return milliseconds, -1 if no timer is armed
+ */
+int httpdTimerWheelTimeoutMs(const HttpdTimerWheel *wheel, uint64_t nowMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef HTTPD_URING_H
+#define HTTPD_URING_H
+
+/**
+ * Minimal io_uring wrapper on the raw system calls, for the io_uring server loop of
+ * httpd-freertos.c
+ *
+ * A ring is owned by a single server task. Submissions are collected with
+ * httpdUringGetSqe() and handed to the kernel in one go by httpdUringSubmitAndWait(), which
+ * also waits for completions. httpdUringReap() then takes all available completions at once.
+ *
+ * Received data lands in a ring of provided buffers registered with the kernel, the kernel
+ * picks a free buffer for each completed receive.
+ */
+
+#ifdef linux
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    int fd;
+
+    // submission queue, shared with the kernel
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;           // sqes handed out, published to sqTail on submit
+    struct io_uring_sqe *sqes;
+
+    // completion queue, shared with the kernel
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    // provided receive buffers, see httpdUringSetupBuffers()
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *bufs;
+    unsigned bufCount;
+    unsigned bufSize;
+    uint16_t bufTail;
+} HttpdUring;
+
+/**
+ * @param entries size of the submission queue, rounded up to a power of two by the kernel
+ * @return false if io_uring isn't available
+ */
+bool httpdUringInit(HttpdUring *ring, unsigned entries);
+void httpdUringDeinit(HttpdUring *ring);
+
+/**
+ * Get a zeroed submission queue entry
+ *
+ * When the queue is full the pending entries are submitted first.
+ *
+ * @return NULL if the queue stays full
+ */
+struct io_uring_sqe *httpdUringGetSqe(HttpdUring *ring);
+
+/**
+ * Submit the pending entries and wait for at least one completion
+ *
+ * @param timeoutMs max time to wait, -1 to wait forever, 0 to not wait
+ * @return number of entries submitted, negative errno on failure
+ */
+int httpdUringSubmitAndWait(HttpdUring *ring, int timeoutMs);
+
+/**
+ * Take up to max completions from the completion queue
+ *
+ * The entries are copied so the queue slots are free again as soon as this returns.
+ */
+unsigned httpdUringReap(HttpdUring *ring, struct io_uring_cqe *cqes, unsigned max);
+
+/**
+ * Register count buffers of size bytes as buffer group bufGroup
+ *
+ * @param count power of two, at most 32768
+ */
+bool httpdUringSetupBuffers(HttpdUring *ring, unsigned bufGroup, unsigned count, unsigned size);
+
+static inline char *httpdUringBuffer(HttpdUring *ring, unsigned bufId)
+{
+    return ring->bufs + (size_t)bufId * ring->bufSize;
+}
+
+/**
+ * Give a buffer the kernel filled back to it
+ */
+void httpdUringRecycleBuffer(HttpdUring *ring, unsigned bufId);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#endif
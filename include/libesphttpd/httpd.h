@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,17 +23,30 @@ extern "C" {
 
 #define HTTPDVER "0.5"
 
-//Max length of request head. This is statically allocated for each connection.
+//Initial length of the request head buffer. Taken from the instance buffer pool while a
+//request is being received and processed.
 #ifndef HTTPD_MAX_HEAD_LEN
 #define HTTPD_MAX_HEAD_LEN		1024
 #endif
 
-//Max post buffer len. This is dynamically malloc'ed if needed.
+//Max length the request head buffer may grow to, eg. for requests with large cookies.
+//Grown buffers are malloc'ed and freed instead of being returned to the pool.
+#ifndef HTTPD_MAX_HEAD_GROW_LEN
+#define HTTPD_MAX_HEAD_GROW_LEN	8192
+#endif
+
+//Max post buffer len. This is taken from the connection arena if needed.
 #ifndef HTTPD_MAX_POST_LEN
 #define HTTPD_MAX_POST_LEN		2048
 #endif
 
-//Send buffer size
+//Size of the connection arena blocks httpdArenaAlloc() hands out memory from. Taken from the
+//instance pool while a request uses them, allocations that don't fit get a malloc'ed block.
+#ifndef HTTPD_ARENA_SIZE
+#define HTTPD_ARENA_SIZE		(HTTPD_MAX_POST_LEN + 512)
+#endif
+
+//Send buffer size. Taken from the instance buffer pool while a response is being sent.
 #ifndef HTTPD_SENDBUFF_SIZE
 #define HTTPD_SENDBUFF_SIZE	2048
 #endif
@@ -47,14 +61,34 @@ extern "C" {
 #define HTTPD_MAX_SENDBUFF_LEN HTTPD_SENDBUFF_MAX_FILL
 #endif
 
-//If some data can't be sent because the underlaying socket doesn't accept the data (like the nonos
-//layer is prone to do), we put it in a backlog that is dynamically malloc'ed. This defines the max
-//size of the backlog.
-#ifndef HTTPD_MAX_BACKLOG_SIZE
-#define HTTPD_MAX_BACKLOG_SIZE	(4*1024)
+//Max number of idle head and send buffers each kept in the instance pool for re-use,
+//buffers released beyond this are freed.
+#ifndef HTTPD_BUFF_POOL_MAX
+#define HTTPD_BUFF_POOL_MAX	8
+#endif
+
+//Max number of buffers a connection can have queued with httpdSendRef() at the same time.
+#ifndef HTTPD_MAX_SEND_REFS
+#define HTTPD_MAX_SEND_REFS	4
+#endif
+
+//Max number of bytes of pipelined requests held back while a request is handled. A client
+//sending more than this before getting the responses is disconnected.
+#ifndef HTTPD_MAX_PIPELINE_LEN
+#define HTTPD_MAX_PIPELINE_LEN	HTTPD_MAX_HEAD_GROW_LEN
+#endif
+
+//Max number of request headers indexed for httpdGetHeader(), further headers are ignored.
+#ifndef HTTPD_MAX_HEADERS
+#define HTTPD_MAX_HEADERS	24
+#endif
+
+//Max number of arguments httpdParseArgs() splits get- or post-data into, further ones are ignored.
+#ifndef HTTPD_MAX_ARGS
+#define HTTPD_MAX_ARGS		16
 #endif
 
-//Max length of CORS token. This amount is allocated per connection.
+//Max length of CORS token.
 #define MAX_CORS_TOKEN_LEN 256
 
 typedef enum
@@ -72,9 +106,22 @@ typedef enum
 	HTTPD_METHOD_OPTIONS,
 	HTTPD_METHOD_PUT,
 	HTTPD_METHOD_PATCH,
-	HTTPD_METHOD_DELETE
+	HTTPD_METHOD_DELETE,
+	HTTPD_METHOD_HEAD
 } RequestTypes;
 
+//Deadlines the platform enforces on a connection, see httpdConnTimeoutKind()
+typedef enum
+{
+	HTTPD_TIMEOUT_NONE,			// no deadline, eg. while a cgi produces the response
+	HTTPD_TIMEOUT_HANDSHAKE,	// tls handshake of a new connection, from the accept
+	HTTPD_TIMEOUT_HEADER,		// receiving the request head, from its first byte
+	HTTPD_TIMEOUT_BODY,			// receiving the request body, between two reads
+	HTTPD_TIMEOUT_KEEPALIVE,	// idle keep-alive connection between two requests
+	HTTPD_TIMEOUT_WRITE,		// response data waiting for the socket, between two writes
+	HTTPD_TIMEOUT_KIND_COUNT
+} HttpdTimeoutKind;
+
 typedef enum
 {
 	HTTPD_TRANSFER_CLOSE,
@@ -86,43 +133,100 @@ typedef struct HttpdPriv HttpdPriv;
 typedef struct HttpdConnData HttpdConnData;
 typedef struct HttpdPostData HttpdPostData;
 typedef struct HttpdInstance HttpdInstance;
+typedef struct HttpdArenaBlock HttpdArenaBlock;
+struct Websock;
 
 
 typedef CgiStatus (* cgiSendCallback)(HttpdConnData *connData);
 typedef CgiStatus (* cgiRecvHandler)(HttpdInstance *pInstance, HttpdConnData *connData, char *data, int len);
+typedef void (* httpdSendRefDoneCb)(void *arg);
 
-#ifdef CONFIG_ESPHTTPD_BACKLOG_SUPPORT
-struct HttpSendBacklogItem {
-	int len;
-	HttpSendBacklogItem *next;
-	char data[];
-};
-#endif
+//A buffer queued with httpdSendRef()
+typedef struct {
+	const char *data;		// next byte to send
+	size_t len;				// bytes left to send
+	int buffEnd;			// sendBuff data up to this offset is sent before this buffer
+	httpdSendRefDoneCb doneCb;
+	void *doneArg;
+} HttpdSendRef;
+
+//Request header found while receiving the head. Offsets are into the head buffer, so they
+//stay valid when it grows (HTTPD_MAX_HEAD_GROW_LEN fits 16 bits).
+typedef struct {
+	uint16_t nameHash;		// hash of the lower case name
+	uint16_t nameLen;
+	uint16_t lineOff;		// start of the header line, which starts with the name
+	uint16_t valueOff;
+	uint16_t valueLen;
+} HttpdHeaderEntry;
+
+//Where the decoder of a chunked request body is
+typedef enum {
+	HTTPD_CHUNK_SIZE_START,
+	HTTPD_CHUNK_SIZE,
+	HTTPD_CHUNK_EXT,
+	HTTPD_CHUNK_SIZE_END,
+	HTTPD_CHUNK_DATA,
+	HTTPD_CHUNK_DATA_END,
+	HTTPD_CHUNK_TRAILER,
+	HTTPD_CHUNK_TRAILER_LINE,
+} HttpdChunkState;
+
+//Argument of get- or post-data found by httpdParseArgs(). Name and value point into the
+//parsed string, they are NOT null terminated nor url-decoded.
+typedef struct {
+	const char *name;
+	const char *value;
+	int nameLen;
+	int valueLen;
+} HttpdArg;
+
+typedef struct {
+	HttpdArg args[HTTPD_MAX_ARGS];
+	int count;
+} HttpdArgs;
 
 //Private data for http connection
 struct HttpdPriv {
-	char head[HTTPD_MAX_HEAD_LEN];
+	char *head;				// request head, NULL while the connection is idle
+	int headSize;			// allocated size of head
 #ifdef CONFIG_ESPHTTPD_CORS_SUPPORT
-	char corsToken[MAX_CORS_TOKEN_LEN];
+	char *corsToken;		// points into head
 #endif
 	int headPos;
-	char sendBuff[HTTPD_SENDBUFF_SIZE];
+	int headLine;			// offset in head of the line that is still being received
+	int bodyLen;			// request Content-Length, moved to post.len once the head is complete
+	HttpdHeaderEntry headers[HTTPD_MAX_HEADERS];
+	int headerCount;
+	char *pipeBuff;			// requests received while the current one is handled, NULL if none
+	int pipeLen;
+	HttpdChunkState chunkState; // chunked request body decoder
+	int chunkLeft;			// size of the current request body chunk, bytes of it still to come
+	char *sendBuff;			// HTTPD_SENDBUFF_SIZE bytes, NULL while there is nothing to send
 	int sendBuffLen;
+	int sendBuffPos;		// bytes of sendBuff already written to the socket
 
 	/** NOTE: chunkHdr, if valid, points at memory assigned to sendBuff
 		so it doesn't have to be freed */
 	char *chunkHdr;
 
-#ifdef CONFIG_ESPHTTPD_BACKLOG_SUPPORT
-	HttpSendBacklogItem *sendBacklog;
-	int sendBacklogSize;
-#endif
+	int sendFd;				// file queued with httpdSendFd(), valid while sendFdLeft > 0
+	off_t sendFdOffset;		// offset of the next byte of sendFd to send
+	size_t sendFdLeft;		// bytes of sendFd still to send
+	long contentLen;		// value set with httpdSetContentLength()
+	HttpdSendRef sendRefs[HTTPD_MAX_SEND_REFS];
+	int sendRefCount;
+	HttpdArenaBlock *arena;	// blocks of httpdArenaAlloc(), newest first, NULL if none
+
 	int flags;
+
+	HttpdInstance *instance; // instance the connection belongs to
 };
 
 //A struct describing the POST data sent inside the http connection.  This is used by the CGI functions
 struct HttpdPostData {
-	int len;				// POST Content-Length
+	int len;				// POST Content-Length. INT_MAX for a chunked body until its last chunk
+							// has been received, then the total length.
 	int buffSize;			// The maximum length of the post buffer
 	int buffLen;			// The amount of bytes in the current post buffer
 	int received;			// The total amount of bytes received so far
@@ -148,6 +252,20 @@ struct HttpdConnData {
 	bool isConnectionClosed;
 };
 
+//The request body isn't collected in post.buff before the cgi is called. Instead post.buff points at
+//the body bytes right where they were received, as soon as they arrive. post.buffLen is the length
+//of this slice, which isn't null terminated and is only valid during the call. Only looked at on
+//the route that takes the body: the first route matching the url that doesn't check the head, or
+//a route checking the head that accepts the body.
+#define HTTPD_ROUTE_FLAG_STREAM_BODY	(1<<0)
+
+//The cgi is called as soon as the request head is complete, before the request body is received.
+//post.buff is NULL then. Returning HTTPD_CGI_MORE accepts the body, which is handed to the cgi as
+//usual. A cgi that doesn't want the body sends its response and returns HTTPD_CGI_DONE. The
+//connection is then closed without receiving the body. Clients that sent "Expect: 100-continue"
+//don't send it at all.
+#define HTTPD_ROUTE_FLAG_CHECK_HEAD	(1<<1)
+
 //A struct describing an url. This is the main struct that's used to send different URL requests to
 //different routines.
 typedef struct {
@@ -155,6 +273,7 @@ typedef struct {
 	cgiSendCallback cgiCb;
 	const void *cgiArg;
 	const void *cgiArg2;
+	int flags;				// HTTPD_ROUTE_FLAG_*
 } HttpdBuiltInUrl;
 
 const char *httpdCgiEx;  /* Magic for use in CgiArgs to interpret CgiArgs2 as HttpdCgiExArg */
@@ -175,6 +294,40 @@ bool httpdUrlDecode(const char *val, int valLen, char *ret, int retLen, int* byt
 
 int httpdFindArg(const char *line, const char *arg, char *buff, int buffLen);
 
+/**
+ * Split a string of get- or post-data (eg. conn->getArgs or conn->post.buff) into its
+ * name=value arguments, without copying or decoding anything
+ *
+ * Parts without '=' are skipped, arguments beyond HTTPD_MAX_ARGS are ignored.
+ *
+ * @return the number of arguments in args
+ */
+int httpdParseArgs(const char *line, HttpdArgs *args);
+
+/**
+ * Find an argument by name in args, the first one if there are several
+ *
+ * @return the argument or NULL if not found
+ */
+const HttpdArg *httpdArgsFind(const HttpdArgs *args, const char *name);
+
+/**
+ * Url-decode the value of arg into buff, null terminated, with at most buffLen bytes used
+ *
+ * @return the number of bytes written, including the null terminator, like httpdFindArg()
+ */
+int httpdArgValue(const HttpdArg *arg, char *buff, int buffLen);
+
+/**
+ * Convert the value of arg to a number, a decimal one or a hexadecimal one with an optional
+ * 0x prefix. Leading spaces are skipped, anything else than the number makes it fail.
+ *
+ * @return true if the whole value is a number that fits, *value is untouched otherwise
+ */
+bool httpdArgToS32(const HttpdArg *arg, int32_t *value);
+bool httpdArgToU32(const HttpdArg *arg, uint32_t *value);
+bool httpdArgToHexU32(const HttpdArg *arg, uint32_t *value);
+
 typedef enum
 {
 	HTTPD_FLAG_NONE = (1 << 0),
@@ -187,12 +340,27 @@ typedef enum
 	InitializationFailure
 } HttpdInitStatus;
 
+/** Idle fixed size buffers kept for re-use, guarded by httpdPlatLock() */
+typedef struct
+{
+	void *freeList;			// linked through the first bytes of each buffer
+	int freeCount;
+} HttpdBuffPool;
+
 /** Common elements to the core server code */
 typedef struct HttpdInstance
 {
 	const HttpdBuiltInUrl *builtInUrls;
 
 	int maxConnections;
+	int maxBodyLen;			// longer request bodies are refused with 413, 0: no limit
+
+	HttpdBuffPool headPool;
+	HttpdBuffPool sendBuffPool;
+	HttpdBuffPool arenaPool;
+
+	// open websockets, guarded by httpdPlatLock()
+	struct Websock *websockets;
 } HttpdInstance;
 
 typedef enum
@@ -206,6 +374,14 @@ typedef enum
 
 const char *httpdGetMimetype(const char *url);
 void httpdSetTransferMode(HttpdConnData *conn, TransferModes mode);
+
+/**
+ * Announce the length of the response body with a Content-Length header
+ *
+ * Must be called before httpdStartResponse(). The response isn't chunked and a
+ * keep-alive connection stays open after the body has been sent.
+ */
+void httpdSetContentLength(HttpdConnData *conn, long len);
 void httpdStartResponse(HttpdConnData *conn, int code);
 void httpdHeader(HttpdConnData *conn, const char *field, const char *val);
 void httpdEndHeaders(HttpdConnData *conn);
@@ -220,11 +396,88 @@ void httpdEndHeaders(HttpdConnData *conn);
  */
 bool httpdGetHeader(HttpdConnData *conn, const char *header, char *ret, int retLen);
 
+/**
+ * Get the value of a certain header in the HTTP client head without copying it
+ * Returns true when found, false when not found.
+ *
+ * The headers are indexed while the head is received, so this doesn't search the head. If a
+ * header is sent more than once, the last one is returned.
+ *
+ * NOTE: '*value' points into the request head and is null terminated. It's valid until the
+ * request has been handled.
+ *
+ * @param valueLen receives the length of the value, may be NULL
+ */
+bool httpdGetHeaderView(HttpdConnData *conn, const char *header, const char **value, int *valueLen);
+
+/**
+ * Get the value of a cookie sent in the Cookie header of the HTTP client head
+ * Returns true when found, false when not found.
+ *
+ * NOTE: '*value' points into the request head and is NOT null terminated.
+ *
+ * @param name is the cookie name, compared case sensitively
+ * @param valueLen receives the length of the value
+ */
+bool httpdGetCookie(HttpdConnData *conn, const char *name, const char **value, int *valueLen);
+
+/**
+ * Allocate len bytes of memory that lives as long as the request
+ *
+ * The memory comes from an arena of the connection and is released all at once when the
+ * request has been handled (after the cgi returned HTTPD_CGI_DONE) or the connection is
+ * closed, so it must not be freed. Meant for the state a cgi keeps in cgiData; it is still
+ * valid in the call with isConnectionClosed set.
+ *
+ * @return memory aligned for any type, NULL when out of memory
+ */
+void *httpdArenaAlloc(HttpdConnData *conn, size_t len);
+
 int httpdSend(HttpdConnData *conn, const char *data, int len);
 int httpdSend_js(HttpdConnData *conn, const char *data, int len);
 int httpdSend_html(HttpdConnData *conn, const char *data, int len);
+
+/**
+ * Send len bytes of the open file fd, starting at offset, after the data already in the send buffer
+ *
+ * Where the platform supports it the file is handed to the socket without being copied
+ * (sendfile() on Linux). TLS and chunked responses fall back to reading the file into the
+ * send buffer part by part.
+ *
+ * The cgi isn't called again until the whole range has been sent, so it has to return
+ * HTTPD_CGI_MORE and keep fd open until then.
+ *
+ * @return 1 when queued, 0 if another file is still being sent
+ */
+int httpdSendFd(HttpdConnData *conn, int fd, off_t offset, size_t len);
+
+/**
+ * Send len bytes of data without copying them into the send buffer
+ *
+ * The buffer is queued behind the data already sent with httpdSend() and is written to the
+ * socket straight from where it is, together with the buffered data around it. It must stay
+ * valid and unchanged until doneCb is called.
+ *
+ * doneCb (may be NULL) is called with doneArg once all of data has been written or when the
+ * connection is closed before that, eg. to free the buffer or drop a reference to it. It is
+ * called with the connection locked.
+ *
+ * @return 1 when queued, 0 if HTTPD_MAX_SEND_REFS buffers are already queued or there is no
+ *         room for the chunk framing. doneCb is not called in that case.
+ */
+int httpdSendRef(HttpdConnData *conn, const void *data, size_t len, httpdSendRefDoneCb doneCb, void *doneArg);
 void httpdFlushSendBuffer(HttpdInstance *pInstance, HttpdConnData *conn);
 CallbackStatus httpdContinue(HttpdInstance *pInstance, HttpdConnData *conn);
+
+/**
+ * Resume a connection from a thread other than the server task
+ *
+ * Queues a httpdContinue() of conn on the server task that owns the connection and wakes
+ * that task up, the cgi is then called from the server task like after a send completed.
+ * Requesting a resume again before it was handled has no further effect, a request for a
+ * connection that is closed in the meantime is dropped.
+ */
+void httpdContinueAsync(HttpdInstance *pInstance, HttpdConnData *conn);
 CallbackStatus httpdConnSendStart(HttpdInstance *pInstance, HttpdConnData *conn);
 void httpdConnSendFinish(HttpdInstance *pInstance, HttpdConnData *conn);
 void httpdAddCacheHeaders(HttpdConnData *connData, const char *mime);
@@ -237,6 +490,14 @@ CallbackStatus httpdDisconCb(HttpdInstance *pInstance, HttpdConnData *pConn);
 /** NOTE: httpdConnectCb() cannot fail */
 void httpdConnectCb(HttpdInstance *pInstance, HttpdConnData *pConn);
 
+/**
+ * Which deadline applies to the connection in its current state
+ *
+ * The platform re-evaluates this after handling events of the connection. A connection that
+ * stays in the same state past the timeout of that kind is closed.
+ */
+HttpdTimeoutKind httpdConnTimeoutKind(HttpdConnData *pConn);
+
 #define esp_container_of(ptr, type, member) ({                      \
         const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
         (type *)( (char *)__mptr - offsetof(type,member) );})
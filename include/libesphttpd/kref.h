@@ -4,6 +4,11 @@
 #include <stdint.h>
 #include <stdatomic.h>
 
+#if !defined(configASSERT)
+#include <assert.h>
+#define configASSERT(x) assert(x)
+#endif
+
 #if !defined(koffsetof)
 #define koffsetof(type, member) ((size_t) &((type *)0)->member)
 #endif
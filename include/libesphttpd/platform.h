@@ -32,6 +32,7 @@ typedef xTimerHandle HttpdPlatTimerHandle;
 
 #include <unistd.h>
 #include <stdbool.h>
+#include "httpd-timerwheel.h"
 typedef struct RtosConnType RtosConnType;
 typedef RtosConnType* ConnTypePtr;
 
@@ -41,7 +42,7 @@ typedef RtosConnType* ConnTypePtr;
 
 typedef struct
 {
-	timer_t timer;
+	HttpdTimer entry; // in the wheel of the platform timer thread
 	int timerPeriodMS;
 	bool autoReload;
 	void (*callback)(void* arg);
@@ -4,8 +4,11 @@
 
 // macros for defining HttpdBuiltInUrl's
 
+/** Route with a CGI handler, two arguments and HTTPD_ROUTE_FLAG_* flags */
+#define ROUTE_CGI_ARG2_FLAGS(path, handler, arg1, arg2, flags)  {(path), (handler), (void *)(arg1), (void *)(arg2), (flags)}
+
 /** Route with a CGI handler and two arguments */
-#define ROUTE_CGI_ARG2(path, handler, arg1, arg2)  {(path), (handler), (void *)(arg1), (void *)(arg2)}
+#define ROUTE_CGI_ARG2(path, handler, arg1, arg2)  ROUTE_CGI_ARG2_FLAGS((path), (handler), (arg1), (arg2), 0)
 
 /** Route with a CGI handler and one argument */
 #define ROUTE_CGI_ARG(path, handler, arg1)         ROUTE_CGI_ARG2((path), (handler), (arg1), NULL)
@@ -13,6 +16,12 @@
 /** Route with a CGI handler and an extended argument */
 #define ROUTE_CGI_EX(path, handler, ex)            ROUTE_CGI_ARG2((path), (handler), &httpdCgiEx, (ex))
 
+/** Route with a CGI handler and one argument that gets the request body as it arrives */
+#define ROUTE_CGI_STREAM(path, handler, arg1)      ROUTE_CGI_ARG2_FLAGS((path), (handler), (arg1), NULL, HTTPD_ROUTE_FLAG_STREAM_BODY)
+
+/** Route with a CGI handler and one argument that is asked to accept the request before the body is received */
+#define ROUTE_CGI_CHECK_HEAD(path, handler, arg1)  ROUTE_CGI_ARG2_FLAGS((path), (handler), (arg1), NULL, HTTPD_ROUTE_FLAG_CHECK_HEAD)
+
 /** Route with an argument-less CGI handler */
 #define ROUTE_CGI(path, handler)                   ROUTE_CGI_ARG2((path), (handler), NULL, NULL)
 
@@ -32,7 +41,7 @@
 #define ROUTE_REDIRECT(path, target)               ROUTE_CGI_ARG((path), cgiRedirect, (const char*)(target))
 
 /** Following routes are basic-auth protected */
-#define ROUTE_AUTH(path, passwdFunc)               ROUTE_CGI_ARG((path), authBasic, (AuthGetUserPw)(passwdFunc))
+#define ROUTE_AUTH(path, passwdFunc)               ROUTE_CGI_ARG2_FLAGS((path), authBasic, (AuthGetUserPw)(passwdFunc), NULL, HTTPD_ROUTE_FLAG_CHECK_HEAD)
 
 /** Websocket endpoint */
 #define ROUTE_WS(path, callback)                   ROUTE_CGI_ARG((path), cgiWebsocket, (WsConnectedCb)(callback))
@@ -40,4 +49,4 @@
 /** Catch-all filesystem route */
 #define ROUTE_FILESYSTEM()                         ROUTE_CGI("*", cgiEspFsHook)
 
-#define ROUTE_END() {NULL, NULL, NULL, NULL}
+#define ROUTE_END() {NULL, NULL, NULL, NULL, 0}
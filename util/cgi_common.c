@@ -15,56 +15,86 @@ typedef struct
 	uint32_t magic;
 } cgiJsonResp_state_t;
 
+// Convert the value of a GET or POST parameter to the type of a CgiArgDef, stored at *pvalue.
+static bool cgiArgConvert(const HttpdArg *arg, CgiArgType type, void *pvalue, size_t size)
+{
+	switch (type)
+	{
+	case CGI_ARG_STRING:
+		httpdArgValue(arg, (char *)pvalue, size);
+		return true;
+	case CGI_ARG_DEC_S32:
+		return httpdArgToS32(arg, (int32_t *)pvalue);
+	case CGI_ARG_DEC_U32:
+		return httpdArgToU32(arg, (uint32_t *)pvalue);
+	case CGI_ARG_HEX_U32:
+		return httpdArgToHexU32(arg, (uint32_t *)pvalue);
+	}
+	return false;
+}
+
 // Common routine for parsing GET or POST parameters.  Parses *allArgs (i.e. connData->getArgs or connData->post.buff) 
-// for a value by name of *argName and then converts the found string value to the requested binary format (sscanf format string).  
+// for a value by name of *argName and then converts the found value to the requested binary format.  
 // (Must supply a buffer and then string value will be available on return.)
-static bool cgiGetArgCommon(const char *allArgs, const char *argName, const char *format, void *pvalue, bool signd, char *buff, int buffLen)
+static bool cgiGetArgCommon(const char *allArgs, const char *argName, CgiArgType type, void *pvalue, char *buff, int buffLen)
 {
-	bool found = false;
+	HttpdArgs args;
 	buff[0] = 0; // null terminate empty string
 
-	int len = httpdFindArg(allArgs, argName, buff, buffLen);
-	if (len > 0)
+	httpdParseArgs(allArgs, &args);
+	const HttpdArg *arg = httpdArgsFind(&args, argName);
+	if (arg == NULL)
 	{
-		int n = 0;
-		char ch; // dummy to test for malformed input
-		if (signd)
-		{
-			int32_t val;
-			n = sscanf(buff, format, &val, &ch);
-			if (n == 1)
-			{
-				/* sscanf found a number to convert */
-				*((int32_t *)pvalue) = val;
-				found = true;
-			}
-		}
-		else
-		{
-			uint32_t val;
-			n = sscanf(buff, format, &val, &ch);
-			if (n == 1)
-			{
-				/* sscanf found a number to convert */
-				*((uint32_t *)pvalue) = val;
-				found = true;
-			}
-		}
+		return false;
 	}
-	return found;
+	httpdArgValue(arg, buff, buffLen);
+	return cgiArgConvert(arg, type, pvalue, 0);
 }
 
 bool cgiGetArgDecS32(const char *allArgs, const char *argName, int *pvalue, char *buff, int buffLen)
 {
-	return cgiGetArgCommon(allArgs, argName, "%d%c", (void *)pvalue, true, buff, buffLen);
+	return cgiGetArgCommon(allArgs, argName, CGI_ARG_DEC_S32, (void *)pvalue, buff, buffLen);
 }
 bool cgiGetArgDecU32(const char *allArgs, const char *argName, uint32_t *pvalue, char *buff, int buffLen)
 {
-	return cgiGetArgCommon(allArgs, argName, "%u%c", (void *)pvalue, false, buff, buffLen);
+	return cgiGetArgCommon(allArgs, argName, CGI_ARG_DEC_U32, (void *)pvalue, buff, buffLen);
 }
 bool cgiGetArgHexU32(const char *allArgs, const char *argName, uint32_t *pvalue, char *buff, int buffLen)
 {
-	return cgiGetArgCommon(allArgs, argName, "%xl%c", (void *)pvalue, false, buff, buffLen);
+	return cgiGetArgCommon(allArgs, argName, CGI_ARG_HEX_U32, (void *)pvalue, buff, buffLen);
+}
+
+uint32_t cgiBindArgs(const char *allArgs, const CgiArgDef *defs, int defCount, void *out)
+{
+	HttpdArgs args;
+	uint32_t found = 0;
+
+	if (defCount > 32)
+	{
+		ESP_LOGE(__func__, "too many arg defs: %d", defCount);
+		defCount = 32;
+	}
+
+	// One pass over the args, each is matched against the defs
+	httpdParseArgs(allArgs, &args);
+	for (int i = 0; i < args.count; i++)
+	{
+		const HttpdArg *arg = &args.args[i];
+		for (int d = 0; d < defCount; d++)
+		{
+			if ((found & (1u << d)) || strlen(defs[d].name) != (size_t)arg->nameLen ||
+				memcmp(defs[d].name, arg->name, arg->nameLen) != 0)
+			{
+				continue;
+			}
+			if (cgiArgConvert(arg, defs[d].type, (char *)out + defs[d].offset, defs[d].size))
+			{
+				found |= 1u << d;
+			}
+			break;
+		}
+	}
+	return found;
 }
 
 bool cgiGetArgString(const char *allArgs, const char *argName, char *buff, int buffLen)
@@ -113,15 +143,16 @@ CgiStatus cgiJsonResponseCommonMulti(HttpdConnData *connData, void **statepp, cJ
 	{
 		if (statep == NULL)
 		{
-			// statep is NULL, need to alloc memory for the state
-			statep = calloc(1, sizeof(cgiJsonResp_state_t)); // all members init to 0
+			// statep is NULL, need to alloc memory for the state, it lives as long as the request
+			statep = httpdArenaAlloc(connData, sizeof(cgiJsonResp_state_t));
 			if (statep == NULL)
 			{
-				ESP_LOGE(__func__, "calloc failed!");
+				ESP_LOGE(__func__, "alloc failed!");
 				cJSON_Delete(jsroot); // Free memory since we can't use it
 				return HTTPD_CGI_DONE;
 
 			}
+			memset(statep, 0, sizeof(cgiJsonResp_state_t)); // all members init to 0
 			statep->magic = MAGICNUM; // write a magic number to the state to validate it later
 			if (statepp != NULL) // caller passed in pointer to statep?
 			{
@@ -178,8 +209,7 @@ CgiStatus cgiJsonResponseCommonMulti(HttpdConnData *connData, void **statepp, cJ
 			cJSON_free(statep->tofree);
 			statep->tofree = NULL;
 		}
-		free(statep); // clear state
-		statep = NULL;
+		statep = NULL; // the state is released with the request
 		if (statepp != NULL) // was pointer to state passed in?
 		{
 			*statepp = NULL; // clear external pointer
@@ -141,15 +141,14 @@ CgiStatus ICACHE_FLASH_ATTR cgiUploadFirmware(HttpdConnData *connData) {
 	esp_err_t err;
 
 	if (connData->isConnectionClosed) {
-		//Connection aborted. Clean up.
-		if (state!=NULL) free(state);
+		//Connection aborted. The state is released with the request.
 		return HTTPD_CGI_DONE;
 	}
 
 	if (state == NULL) {
 		//First call. Allocate and initialize state variable.
 		ESP_LOGD(TAG, "Firmware upload cgi start");
-		state = malloc(sizeof(UploadState));
+		state = httpdArenaAlloc(connData, sizeof(UploadState));
 		if (state==NULL) {
 			ESP_LOGE(TAG, "Can't allocate firmware upload struct");
 			return HTTPD_CGI_DONE;
@@ -318,7 +317,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiUploadFirmware(HttpdConnData *connData) {
 		}
 		cJSON_AddStringToObject(jsroot, "message", state->err);
 		cJSON_AddBoolToObject(jsroot, "success", (state->state==FLST_DONE)?true:false);
-		free(state);
 
 		cgiJsonResponseCommonSingle(connData, jsroot); // Send the json response!
 		return HTTPD_CGI_DONE;
@@ -336,15 +334,14 @@ CgiStatus ICACHE_FLASH_ATTR cgiUploadFirmware(HttpdConnData *connData) {
 	char buff[128];
 
 	if (connData->isConnectionClosed) {
-		//Connection aborted. Clean up.
-		if (state!=NULL) free(state);
+		//Connection aborted. The state is released with the request.
 		return HTTPD_CGI_DONE;
 	}
 
 	if (state==NULL) {
 		//First call. Allocate and initialize state variable.
 		ESP_LOGE(TAG, "Firmware upload cgi start");
-		state=malloc(sizeof(UploadState));
+		state=httpdArenaAlloc(connData, sizeof(UploadState));
 		if (state==NULL) {
 			ESP_LOGE(TAG, "Can't allocate firmware upload struct");
 			return HTTPD_CGI_DONE;
@@ -489,7 +486,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiUploadFirmware(HttpdConnData *connData) {
 			httpdSend(connData, state->err, -1);
 			httpdSend(connData, "\n", -1);
 		}
-		free(state);
 		return HTTPD_CGI_DONE;
 	}
 
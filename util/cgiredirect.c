@@ -52,7 +52,7 @@ CgiStatus ICACHE_FLASH_ATTR cgiRedirectToHostname(HttpdConnData *connData) {
     }
 
 	//Not the same. Redirect to real hostname.
-	buff = malloc(strlen((char*)connData->cgiArg)+sizeof(hostFmt));
+	buff = httpdArenaAlloc(connData, strlen((char*)connData->cgiArg)+sizeof(hostFmt));
 	if (buff==NULL) {
         ESP_LOGE(TAG, "allocating memory");
 		//Bail out
@@ -61,7 +61,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiRedirectToHostname(HttpdConnData *connData) {
 	sprintf(buff, hostFmt, (char*)connData->cgiArg);
 	ESP_LOGD(TAG, "Redirecting to hostname url %s", buff);
 	httpdRedirect(connData, buff);
-	free(buff);
 	return HTTPD_CGI_DONE;
 }
 
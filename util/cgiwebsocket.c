@@ -17,6 +17,7 @@ Websocket support for esphttpd. Inspired by https://github.com/dangrie158/ESP-82
 #include "libesphttpd/sha1.h"
 #include "libesphttpd_base64.h"
 #include "libesphttpd/cgiwebsocket.h"
+#include "libesphttpd/kref.h"
 
 #include "esp_log.h"
 const static char* TAG = "cgiwebsocket";
@@ -78,17 +79,30 @@ struct WebsockFrame {
 	uint8_t mask[4];
 };
 
+//Broadcast frame waiting for the server task of a connection that was busy
+typedef struct WebsockPending WebsockPending;
+struct WebsockPending {
+	WebsockPending *next;
+	int flags;
+	int len;
+	char data[];
+};
+
 struct WebsockPriv {
 	struct WebsockFrame fr;
 	uint8_t maskCtr;
 	uint8 frameCont;
 	uint8 closedHere;
+	uint8 dead; //connection is gone, set under the connection lock
 	int wsStatus;
-	Websock *next; //in linked list
+	char *url; //copy of the url the websocket was opened on
+	struct kref ref; //one reference for the connection, one for each pending broadcast
+	Websock *ws; //back pointer for the kref release
+	Websock *next; //in linked list of the instance
+	WebsockPending *pending; //queued broadcast frames, oldest first, guarded by httpdPlatLock()
+	WebsockPending **pendingTail;
 };
 
-static Websock *llStart=NULL;
-
 static int ICACHE_FLASH_ATTR sendFrameHead(Websock *ws, int opcode, int len) {
 	char buf[14];
 	int i=0;
@@ -125,60 +139,170 @@ int ICACHE_FLASH_ATTR cgiWebsocketSend(HttpdInstance *pInstance, Websock *ws, co
 	// add FIN to last frame
 	if (!(flags&WEBSOCK_FLAG_MORE)) fl|=FLAG_FIN;
 
-    if (ws->conn->isConnectionClosed) {
-        ESP_LOGE(TAG, "Websocket closed, cannot send");
-        return WEBSOCK_CLOSED;
-    }
+	httpdPlatConnLock(ws->conn);
+	if (ws->priv->dead || ws->conn->isConnectionClosed) {
+		httpdPlatConnUnlock(ws->conn);
+		ESP_LOGE(TAG, "Websocket closed, cannot send");
+		return WEBSOCK_CLOSED;
+	}
 
-	httpdPlatLock(pInstance);
 	sendFrameHead(ws, fl, len);
 	if (len!=0) r=httpdSend(ws->conn, data, len);
 	httpdFlushSendBuffer(pInstance, ws->conn);
-	httpdPlatUnlock(pInstance);
+	httpdPlatConnUnlock(ws->conn);
 	return r;
 }
 
+static void ICACHE_FLASH_ATTR websockRelease(struct kref *ref) {
+	WebsockPriv *priv=kcontainer_of(ref, WebsockPriv, ref);
+	Websock *ws=priv->ws;
+	free(priv->url);
+	free(priv);
+	free(ws);
+}
+
+//Queue a broadcast frame for a websocket whose connection lock is held by someone else, and
+//have its server task send it. Returns false if the frame can't be queued.
+static bool ICACHE_FLASH_ATTR websockQueue(HttpdInstance *pInstance, Websock *ws, const char *data, int len, int flags) {
+	WebsockPending *p=malloc(sizeof(WebsockPending)+len);
+	if (p==NULL) {
+		ESP_LOGE(TAG, "Can't allocate mem for broadcast frame");
+		return false;
+	}
+	p->next=NULL;
+	p->flags=flags;
+	p->len=len;
+	memcpy(p->data, data, len);
+
+	httpdPlatLock(pInstance);
+	if (ws->priv->dead) {
+		httpdPlatUnlock(pInstance);
+		free(p);
+		return false;
+	}
+	*ws->priv->pendingTail=p;
+	ws->priv->pendingTail=&p->next;
+	httpdPlatUnlock(pInstance);
+
+	httpdPlatContinueAsync(pInstance, ws->conn);
+	return true;
+}
+
+//Send the queued broadcast frames, called with the connection lock held.
+static void ICACHE_FLASH_ATTR websockSendPending(HttpdInstance *pInstance, Websock *ws) {
+	WebsockPending *p;
+
+	httpdPlatLock(pInstance);
+	p=ws->priv->pending;
+	ws->priv->pending=NULL;
+	ws->priv->pendingTail=&ws->priv->pending;
+	httpdPlatUnlock(pInstance);
+
+	while (p!=NULL) {
+		WebsockPending *next=p->next;
+		cgiWebsocketSend(pInstance, ws, p->data, p->len, p->flags);
+		free(p);
+		p=next;
+	}
+}
+
 //Broadcast data to all websockets at a specific url. Returns the amount of connections sent to.
+//The matching websockets are collected under the instance lock, the data is then sent to
+//each of them under its own connection lock so other connections aren't blocked meanwhile.
+//The caller may hold the lock of its own connection, eg. in a receive callback, so the lock of
+//another connection is never waited for: when it is busy the frame is queued and sent by the
+//server task of that connection.
 int ICACHE_FLASH_ATTR cgiWebsockBroadcast(HttpdInstance *pInstance, const char *resource, char *data, int len, int flags) {
-	Websock *lw=llStart;
-	int ret=0;
-	while (lw!=NULL) {
-		if (strcmp(lw->conn->url, resource)==0) {
-			httpdConnSendStart(pInstance, lw->conn);
-			cgiWebsocketSend(pInstance, lw, data, len, flags);
-			httpdConnSendFinish(pInstance, lw->conn);
+	Websock *lw;
+	Websock **targets;
+	int count=0, i, ret=0;
+
+	httpdPlatLock(pInstance);
+	for (lw=pInstance->websockets; lw!=NULL; lw=lw->priv->next) {
+		if (strcmp(lw->priv->url, resource)==0) count++;
+	}
+	httpdPlatUnlock(pInstance);
+	if (count==0) return 0;
+
+	targets=malloc(sizeof(Websock*)*count);
+	if (targets==NULL) {
+		ESP_LOGE(TAG, "Can't allocate mem for broadcast");
+		return 0;
+	}
+
+	//The list may have changed in between, take at most count websockets
+	httpdPlatLock(pInstance);
+	i=0;
+	for (lw=pInstance->websockets; lw!=NULL && i<count; lw=lw->priv->next) {
+		if (strcmp(lw->priv->url, resource)==0) {
+			kref_get(&lw->priv->ref);
+			targets[i++]=lw;
+		}
+	}
+	httpdPlatUnlock(pInstance);
+	count=i;
+
+	for (i=0; i<count; i++) {
+		lw=targets[i];
+		if (httpdPlatConnTryLock(lw->conn)) {
+			if (!lw->priv->dead) {
+				httpdConnSendStart(pInstance, lw->conn);
+				//Frames queued before go out first
+				websockSendPending(pInstance, lw);
+				cgiWebsocketSend(pInstance, lw, data, len, flags);
+				httpdConnSendFinish(pInstance, lw->conn);
+				ret++;
+			}
+			httpdPlatConnUnlock(lw->conn);
+		} else if (websockQueue(pInstance, lw, data, len, flags)) {
 			ret++;
 		}
-		lw=lw->priv->next;
+		kref_put(&lw->priv->ref, websockRelease);
 	}
+	free(targets);
 	return ret;
 }
 
 
 void ICACHE_FLASH_ATTR cgiWebsocketClose(HttpdInstance *pInstance, Websock *ws, int reason) {
 	char rs[2]={reason>>8, reason&0xff};
-	httpdPlatLock(pInstance);
-	sendFrameHead(ws, FLAG_FIN|OPCODE_CLOSE, 2);
-	httpdSend(ws->conn, rs, 2);
-	ws->priv->closedHere=1;
-	httpdFlushSendBuffer(pInstance, ws->conn);
-	httpdPlatUnlock(pInstance);
+	httpdPlatConnLock(ws->conn);
+	if (!ws->priv->dead) {
+		sendFrameHead(ws, FLAG_FIN|OPCODE_CLOSE, 2);
+		httpdSend(ws->conn, rs, 2);
+		ws->priv->closedHere=1;
+		httpdFlushSendBuffer(pInstance, ws->conn);
+	}
+	httpdPlatConnUnlock(ws->conn);
 }
 
 
-static void ICACHE_FLASH_ATTR websockFree(Websock *ws) {
+//Called with the connection lock held when the websocket connection goes away. The Websock
+//itself is freed when the last broadcast referencing it is done.
+static void ICACHE_FLASH_ATTR websockFree(HttpdInstance *pInstance, Websock *ws) {
 	ESP_LOGD(TAG, "");
 	if (ws->closeCb) ws->closeCb(ws);
 	//Clean up linked list
-	if (llStart==ws) {
-		llStart=ws->priv->next;
-	} else if (llStart) {
-		Websock *lws=llStart;
+	httpdPlatLock(pInstance);
+	if (pInstance->websockets==ws) {
+		pInstance->websockets=ws->priv->next;
+	} else if (pInstance->websockets) {
+		Websock *lws=pInstance->websockets;
 		//Find ws that links to this one.
 		while (lws!=NULL && lws->priv->next!=ws) lws=lws->priv->next;
 		if (lws!=NULL) lws->priv->next=ws->priv->next;
 	}
-	if (ws->priv) free(ws->priv);
+	//Also set under the instance lock so no broadcast frame is queued anymore
+	ws->priv->dead=1;
+	WebsockPending *p=ws->priv->pending;
+	ws->priv->pending=NULL;
+	httpdPlatUnlock(pInstance);
+	while (p!=NULL) {
+		WebsockPending *next=p->next;
+		free(p);
+		p=next;
+	}
+	kref_put(&ws->priv->ref, websockRelease);
 }
 
 CgiStatus ICACHE_FLASH_ATTR cgiWebSocketRecv(HttpdInstance *pInstance, HttpdConnData *connData, char *data, int len) {
@@ -286,8 +410,7 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebSocketRecv(HttpdInstance *pInstance, HttpdConn
 	if (r==HTTPD_CGI_DONE) {
 		//We're going to tell the main webserver we're done. The webserver expects us to clean up by ourselves
 		//we're chosing to be done. Do so.
-		websockFree(ws);
-		free(connData->cgiData);
+		websockFree(pInstance, ws);
 		connData->cgiData=NULL;
 	}
 	return r;
@@ -296,15 +419,15 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebSocketRecv(HttpdInstance *pInstance, HttpdConn
 //Websocket 'cgi' implementation
 CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData) {
 	char buff[256];
-	int i;
+	const char *value, *key;
+	int i, keyLen;
 	sha1nfo s;
 	if (connData->isConnectionClosed) {
 		//Connection aborted. Clean up.
 		ESP_LOGD(TAG, "Cleanup");
 		if (connData->cgiData) {
 			Websock *ws=(Websock*)connData->cgiData;
-			websockFree(ws);
-			free(connData->cgiData);
+			websockFree(connData->priv.instance, ws);
 			connData->cgiData=NULL;
 		}
 		return HTTPD_CGI_DONE;
@@ -313,10 +436,10 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData) {
 	if (connData->cgiData==NULL) {
 //		httpd_printf("WS: First call\n");
 		//First call here. Check if client headers are OK, send server header.
-		i=httpdGetHeader(connData, "Upgrade", buff, sizeof(buff)-1);
-		ESP_LOGD(TAG, "Upgrade: %s", buff);
-		if (i && strcasecmp(buff, "websocket")==0) {
-			i=httpdGetHeader(connData, "Sec-WebSocket-Key", buff, sizeof(buff)-1);
+		i=httpdGetHeaderView(connData, "Upgrade", &value, NULL);
+		ESP_LOGD(TAG, "Upgrade: %s", i?value:"");
+		if (i && strcasecmp(value, "websocket")==0) {
+			i=httpdGetHeaderView(connData, "Sec-WebSocket-Key", &key, &keyLen);
 			if (i) {
 //				httpd_printf("WS: Key: %s\n", buff);
 				//Seems like a WebSocket connection.
@@ -336,11 +459,22 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData) {
 					return HTTPD_CGI_DONE;
 				}
 				memset(ws->priv, 0, sizeof(WebsockPriv));
+				ws->priv->url=strdup(connData->url);
+				if (ws->priv->url==NULL) {
+					ESP_LOGE(TAG, "Can't allocate mem for websocket url");
+					free(ws->priv);
+					free(connData->cgiData);
+					connData->cgiData=NULL;
+					return HTTPD_CGI_DONE;
+				}
+				kref_init(&ws->priv->ref);
+				ws->priv->ws=ws;
+				ws->priv->pendingTail=&ws->priv->pending;
 				ws->conn=connData;
 				//Reply with the right headers.
-				strcat(buff, WS_GUID);
 				sha1_init(&s);
-				sha1_write(&s, buff, strlen(buff));
+				sha1_write(&s, key, keyLen);
+				sha1_write(&s, WS_GUID, strlen(WS_GUID));
 				httpdSetTransferMode(connData, HTTPD_TRANSFER_NONE);
 				httpdStartResponse(connData, 101);
 				httpdHeader(connData, "Upgrade", "websocket");
@@ -354,13 +488,11 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData) {
 				WsConnectedCb connCb=connData->cgiArg;
 				connCb(ws);
 				//Insert ws into linked list
-				if (llStart==NULL) {
-					llStart=ws;
-				} else {
-					Websock *lw=llStart;
-					while (lw->priv->next) lw=lw->priv->next;
-					lw->priv->next=ws;
-				}
+				HttpdInstance *pInstance=connData->priv.instance;
+				httpdPlatLock(pInstance);
+				ws->priv->next=pInstance->websockets;
+				pInstance->websockets=ws;
+				httpdPlatUnlock(pInstance);
 				return HTTPD_CGI_MORE;
 			}
 		}
@@ -370,8 +502,9 @@ CgiStatus ICACHE_FLASH_ATTR cgiWebsocket(HttpdConnData *connData) {
 		return HTTPD_CGI_DONE;
 	}
 
-	//Sending is done. Call the sent callback if we have one.
+	//Sending is done, or broadcast frames were queued. Call the sent callback if we have one.
 	Websock *ws=(Websock*)connData->cgiData;
+	if (ws) websockSendPending(connData->priv.instance, ws);
 	if (ws && ws->sentCb) ws->sentCb(ws);
 
 	return HTTPD_CGI_MORE;
@@ -72,13 +72,12 @@ static size_t getFilepath(HttpdConnData *connData, char *filepath, size_t len)
 
 CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 	FILE *file=connData->cgiData;
-	int len;
-	char buff[FILE_CHUNK_LEN];
 	char filename[MAX_FILENAME_LENGTH + 1];
-	char acceptEncodingBuffer[64];
+	const char *acceptEncoding;
 	int isGzip;
 	bool isIndex = false;
 	struct stat filestat;	
+	struct stat st = {};
 
 	if (connData->isConnectionClosed) {
 		//Connection aborted. Clean up.
@@ -93,7 +92,7 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 	//First call to this cgi.
 	if (file==NULL) {
 		isGzip = 0;
-		if (connData->requestType!=HTTPD_METHOD_GET) {
+		if (connData->requestType!=HTTPD_METHOD_GET && connData->requestType!=HTTPD_METHOD_HEAD) {
 			return HTTPD_CGI_NOTFOUND;  //	return and allow another cgi function to handle it
 		}
 
@@ -108,7 +107,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 
 		file = fopen(filename, "r");
 		if (file != NULL) {
-			struct stat st = {};
 			fstat(fileno(file), &st);
 			isGzip = (st.st_spare4[0] == ESPFS_MAGIC && st.st_spare4[1] & ESPFS_FLAG_GZIP);
 			ESP_LOGD(__func__, "fopen: %s, r", filename);
@@ -129,8 +127,8 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 		
 			// Check the browser's "Accept-Encoding" header. If the client does not
 			// advertise that he accepts GZIP send a warning message (telnet users for e.g.)
-			httpdGetHeader(connData, "Accept-Encoding", acceptEncodingBuffer, 64);
-			if (strstr(acceptEncodingBuffer, "gzip") == NULL) {
+			bool found = httpdGetHeaderView(connData, "Accept-Encoding", &acceptEncoding, NULL);
+			if (!found || (strstr(acceptEncoding, "gzip") == NULL)) {
 				//No Accept-Encoding: gzip header present
 				httpdSend(connData, gzipNonSupportedMessage, -1);
 				fclose(file);
@@ -138,9 +136,11 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 				ESP_LOGE(__func__, "client does not accept gzip!");
 				return HTTPD_CGI_DONE;
 			}
+			fstat(fileno(file), &st);
 		}
 
 		connData->cgiData=file;
+		httpdSetContentLength(connData, st.st_size);
 		httpdStartResponse(connData, 200);
 
 		const char *mimetype = NULL;
@@ -182,21 +182,22 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsGet(HttpdConnData *connData) {
 			httpdAddCacheHeaders(connData, mimetype);
 		}
 		httpdEndHeaders(connData);
-		return HTTPD_CGI_MORE;
-	}
 
-	len=fread(buff, 1, FILE_CHUNK_LEN, file);
-	if (len>0) httpdSend(connData, buff, len);
-	if (len!=FILE_CHUNK_LEN) {
-		//We're done.
-		fclose(file);
-		ESP_LOGD(__func__, "fclose: %s, r", filename);
+		//A HEAD request only wants the headers, don't touch the file.
+		if (connData->requestType==HTTPD_METHOD_HEAD) {
+			fclose(file);
+			return HTTPD_CGI_DONE;
+		}
 
-		return HTTPD_CGI_DONE;
-	} else {
-		//Ok, till next time.
+		//The file is streamed by the server, we're called again once it has been sent.
+		httpdSendFd(connData, fileno(file), 0, st.st_size);
 		return HTTPD_CGI_MORE;
 	}
+
+	//We're done.
+	fclose(file);
+	ESP_LOGD(__func__, "fclose: %s, r", filename);
+	return HTTPD_CGI_DONE;
 }
 
 typedef struct {
@@ -223,7 +224,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsTemplate(HttpdConnData *connData) {
 		if(tpd->file != NULL){
 			fclose(tpd->file);
 		}
-		free(tpd);
 		return HTTPD_CGI_DONE;
 	}
 
@@ -241,14 +241,13 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsTemplate(HttpdConnData *connData) {
 
 		getFilepath(connData, filename, sizeof(filename));
 
-		tpd=(TplData *)malloc(sizeof(TplData));
+		tpd=(TplData *)httpdArenaAlloc(connData, sizeof(TplData));
 		if (tpd==NULL) return HTTPD_CGI_NOTFOUND;
 		tpd->file=fopen(connData->url, "r");
 		tpd->tplArg=NULL;
 		tpd->tokenPos=-1;
 		if (tpd->file==NULL) {
 			fclose(tpd->file);
-			free(tpd);
 			return HTTPD_CGI_NOTFOUND;
 		}
 
@@ -329,7 +328,6 @@ CgiStatus ICACHE_FLASH_ATTR cgiEspVfsTemplate(HttpdConnData *connData) {
 		//We're done.
 		((TplCallback)(connData->cgiArg))(connData, NULL, &tpd->tplArg);
 		fclose(tpd->file);
-		free(tpd);
 		return HTTPD_CGI_DONE;
 	} else {
 		//Ok, till next time.
@@ -395,7 +393,6 @@ CgiStatus   cgiEspVfsUpload(HttpdConnData *connData) {
 				fclose(state->file);
 				ESP_LOGD(__func__, "fclose: %s, r", state->filename);
 			}
-			free(state);
 		}
 		ESP_LOGE(__func__, "Connection aborted!");
 		return HTTPD_CGI_DONE;
@@ -407,7 +404,7 @@ CgiStatus   cgiEspVfsUpload(HttpdConnData *connData) {
 			return HTTPD_CGI_NOTFOUND;  //	return and allow another cgi function to handle it
 		}
 		//First call. Allocate and initialize state variable.
-		state = malloc(sizeof(UploadState));
+		state = httpdArenaAlloc(connData, sizeof(UploadState));
 		if (state==NULL) {
 			ESP_LOGE(__func__, "Can't allocate upload struct");
 			//return HTTPD_CGI_NOTFOUND;  // Let cgiNotFound() deal with extra post data.
@@ -537,7 +534,6 @@ error_first:
 		cJSON_AddNumberToObject(jsroot, "bytes received", connData->post.received);
 		cJSON_AddNumberToObject(jsroot, "bytes written", state->b_written);
 		cJSON_AddBoolToObject(jsroot, "success", state->state==UPSTATE_DONE);
-		free(state);
 
 		cgiJsonResponseCommonSingle(connData, jsroot); // Send the json response!
 		return HTTPD_CGI_DONE;
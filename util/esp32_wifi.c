@@ -500,6 +500,17 @@ err_out:
     return result;
 }
 
+struct scan_args
+{
+    uint32_t clear;
+    uint32_t start;
+};
+
+static const CgiArgDef scan_arg_defs[] = {
+    CGI_ARG("clear", CGI_ARG_DEC_U32, struct scan_args, clear),
+    CGI_ARG("start", CGI_ARG_DEC_U32, struct scan_args, start),
+};
+
 /* Get the results of an earler scan in JSON format. . Optionally start a new scan.
  * See API spec: /README-wifi_api.md
  */
@@ -512,7 +523,8 @@ CgiStatus cgiWiFiScan(HttpdConnData *connData)
         goto cleanup; // make sure to free memory
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_POST)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD &&
+        connData->requestType != HTTPD_METHOD_POST)
     {
         return HTTPD_CGI_NOTFOUND;
     }
@@ -532,16 +544,17 @@ CgiStatus cgiWiFiScan(HttpdConnData *connData)
             allArgs = connData->post.buff;
         }
         cJSON *jsargs = cJSON_AddObjectToObject(jsroot, "args");
-        char arg_buf[ARGBUFSIZE];
 
-        uint32_t arg_clear = 0;
-        if (cgiGetArgDecU32(allArgs, "clear", &(arg_clear), arg_buf, sizeof(arg_buf)))
+        struct scan_args args = {0};
+        uint32_t found = cgiBindArgs(allArgs, scan_arg_defs, sizeof(scan_arg_defs) / sizeof(scan_arg_defs[0]), &args);
+        uint32_t arg_clear = args.clear;
+        if (found & (1 << 0))
         {
             cJSON_AddNumberToObject(jsargs, "clear", arg_clear);
         }
 
-        uint32_t arg_start = 0;
-        if (cgiGetArgDecU32(allArgs, "start", &(arg_start), arg_buf, sizeof(arg_buf)))
+        uint32_t arg_start = args.start;
+        if (found & (1 << 1))
         {
             cJSON_AddNumberToObject(jsargs, "start", arg_start);
         }
@@ -1164,6 +1177,11 @@ err_out:
     return result;
 }
 
+static const CgiArgDef connect_arg_defs[] = {
+    CGI_ARG("ssid", CGI_ARG_STRING, wifi_sta_config_t, ssid),
+    CGI_ARG("pass", CGI_ARG_STRING, wifi_sta_config_t, password),
+};
+
 /* Trigger a connection attempt to the AP with the given SSID and password. */
 /* Connect WiFi STA.  Use other API /wifi/sta to check status.
  * See API spec: /README-wifi_api.md
@@ -1176,7 +1194,8 @@ CgiStatus cgiWiFiConnect(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_POST)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD &&
+        connData->requestType != HTTPD_METHOD_POST)
     {
         return HTTPD_CGI_NOTFOUND;
     }
@@ -1188,8 +1207,6 @@ CgiStatus cgiWiFiConnect(HttpdConnData *connData)
         allArgs = connData->post.buff;
     }
 
-    int len;
-    char arg_buf[ARGBUFSIZE];
     struct wifi_cfg cfg;
     esp_err_t result;
     cJSON *jsroot = cJSON_CreateObject();
@@ -1209,17 +1226,14 @@ CgiStatus cgiWiFiConnect(HttpdConnData *connData)
 
     wifi_sta_config_t *sta = &(cfg.sta.sta);
     cJSON *jsargs = cJSON_AddObjectToObject(jsroot, "args");
-    len = httpdFindArg(allArgs, "ssid", arg_buf, sizeof(arg_buf));
-    if (len > 0)
+    uint32_t found = cgiBindArgs(allArgs, connect_arg_defs, sizeof(connect_arg_defs) / sizeof(connect_arg_defs[0]), sta);
+    if (found & (1 << 0))
     {
-        strlcpy((char *)&(sta->ssid), arg_buf, sizeof(sta->ssid));
         cJSON_AddStringToObject(jsargs, "ssid", (char *)sta->ssid);
     }
 
-    len = httpdFindArg(allArgs, "pass", arg_buf, sizeof(arg_buf));
-    if (len > 0)
+    if (found & (1 << 1))
     {
-        strlcpy((char *)&(sta->password), arg_buf, sizeof(sta->password));
         cJSON_AddStringToObject(jsargs, "pass", (char *)sta->password);
     }
     else
@@ -1267,7 +1281,8 @@ CgiStatus cgiWiFiSetMode(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_POST)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD &&
+        connData->requestType != HTTPD_METHOD_POST)
     {
         return HTTPD_CGI_NOTFOUND;
     }
@@ -1368,7 +1383,8 @@ CgiStatus cgiWiFiStartWps(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_POST)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD &&
+        connData->requestType != HTTPD_METHOD_POST)
     {
         return HTTPD_CGI_NOTFOUND;
     }
@@ -1444,7 +1460,8 @@ CgiStatus cgiWiFiAPSettings(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_POST)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD &&
+        connData->requestType != HTTPD_METHOD_POST)
     {
         return HTTPD_CGI_NOTFOUND;
     }
@@ -1562,7 +1579,7 @@ CgiStatus cgiWiFiConnStatus(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
 
-    if (connData->requestType != HTTPD_METHOD_GET)
+    if (connData->requestType != HTTPD_METHOD_GET && connData->requestType != HTTPD_METHOD_HEAD)
     {
         return HTTPD_CGI_NOTFOUND;
     }